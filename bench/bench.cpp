@@ -0,0 +1,261 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2018 Olivier Delaneau, University of Lausanne
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+#include <phaser/phaser_header.h>
+
+#include <io/genotype_reader.h>
+#include <io/haplotype_writer.h>
+
+#include <modules/builder.h>
+#include <modules/pbwt_solver.h>
+
+#include <iomanip>
+#include <sys/stat.h>
+
+/*
+ * Microbenchmarks of the core kernels on a synthetic cohort (make bench, then bin/shapeit4_bench --help).
+ * Each kernel runs until --min-time seconds have elapsed and reports the mean time per call and the
+ * throughput over the data it touches.
+ */
+
+class bench_runner {
+public:
+	double min_time;
+	string filter;
+
+	bench_runner(double _min_time, string _filter) : min_time(_min_time), filter(_filter) {
+		cout << left << setw(36) << "Kernel" << setw(32) << "Configuration" << right << setw(10) << "Calls" << setw(16) << "ns/op" << setw(12) << "GB/s" << endl;
+	}
+
+	bool selected(string name) {
+		return filter.empty() || name.find(filter) != string::npos;
+	}
+
+	//bytes is the amount of data touched by one call
+	template < class F >
+	void run(string name, string config, double bytes, F op) {
+		if (!selected(name)) return;
+		op();
+		unsigned long n_calls = 0;
+		auto t0 = std::chrono::steady_clock::now();
+		double elapsed = 0.0;
+		do {
+			op();
+			n_calls ++;
+			elapsed = std::chrono::duration < double > (std::chrono::steady_clock::now() - t0).count();
+		} while (elapsed < min_time);
+		double ns = elapsed * 1e9 / n_calls;
+		cout << left << setw(36) << name << setw(32) << config << right << setw(10) << n_calls << setw(16) << fixed << setprecision(0) << ns << setw(12) << setprecision(3) << bytes / ns << endl;
+	}
+};
+
+/*
+ * Haplotypes are mosaics of a few founders (switch rate 1/200 per site, mutation rate 1/1000), so that
+ * PBWT neighbours, IBD sharing and het rates look like real data. Sites are 100bp apart at 1cM/Mb.
+ */
+void makeCohort(phaser & P, unsigned int n_main, unsigned int n_ref, unsigned int n_sites, unsigned int n_founders, double missing_rate) {
+	unsigned long n_main_haps = 2UL * n_main, n_haps = 2UL * (n_main + n_ref);
+	P.G.allocate(n_main, n_sites);
+	for (int i = 0 ; i < n_main ; i ++) P.G.vecG[i]->name = "sample" + stb.str(i);
+	P.H.n_ind = n_main;
+	P.H.n_hap = n_haps;
+	P.H.n_site = n_sites;
+	P.H.H_opt_var.allocate(n_sites, n_haps);
+	P.H.H_opt_hap.allocate(n_haps, n_sites);
+
+	vector < int > founder = vector < int > (n_haps);
+	vector < unsigned char > alleles = vector < unsigned char > (n_haps);
+	for (unsigned long h = 0 ; h < n_haps ; h ++) founder[h] = rng.getInt(n_founders);
+	string chr = "1", id = ".", ref = "A", alt = "C";
+	for (unsigned int l = 0 ; l < n_sites ; l ++) {
+		double freq = pow(rng.getDouble(), 3.0);
+		vector < bool > founder_alleles = vector < bool > (n_founders);
+		for (int f = 0 ; f < n_founders ; f ++) founder_alleles[f] = (rng.getDouble() < freq);
+		for (unsigned long h = 0 ; h < n_haps ; h ++) {
+			if (rng.getDouble() < 0.005) founder[h] = rng.getInt(n_founders);
+			alleles[h] = founder_alleles[founder[h]] ^ (rng.getDouble() < 0.001);
+		}
+
+		variant * newV = new variant (chr, 1 + 100 * l, id, ref, alt, P.V.size());
+		unsigned int cref = 0, calt = 0, cmis = 0;
+		for (unsigned int i = 0 ; i < n_main ; i ++) {
+			bool a0 = alleles[2*i+0], a1 = alleles[2*i+1];
+			bool mi = (rng.getDouble() < missing_rate);
+			if (a0) VAR_SET_HAP0(MOD2(l), P.G.vecG[i]->Variants[DIV2(l)]);
+			if (a1) VAR_SET_HAP1(MOD2(l), P.G.vecG[i]->Variants[DIV2(l)]);
+			if (mi) VAR_SET_MIS(MOD2(l), P.G.vecG[i]->Variants[DIV2(l)]);
+			if (!mi && a0 != a1) VAR_SET_HET(MOD2(l), P.G.vecG[i]->Variants[DIV2(l)]);
+			if (!mi) { a0?calt++:cref++; a1?calt++:cref++; }
+			else cmis ++;
+		}
+		for (unsigned long h = n_main_haps ; h < n_haps ; h ++) {
+			P.H.H_opt_hap.set(h, l, alleles[h]);
+			alleles[h]?calt++:cref++;
+		}
+		newV->cref = cref; newV->calt = calt; newV->cmis = cmis;
+		P.V.push(newV);
+	}
+	P.G.imputeMonomorphic(P.V, P.options["thread"].as < int > ());
+	P.V.setGeneticMap();
+}
+
+//First segments of an individual spanning at least n_loci loci, with the coordinates compute_job::make would give them
+coordinates firstWindow(genotype * g, unsigned int n_loci) {
+	coordinates C;
+	unsigned int prev_dipcount = 1, t = 0, a = 0, v = 0;
+	int s = 0;
+	for (; s < g->n_segments ; s ++) {
+		unsigned int curr_dipcount = g->countDiplotypes(g->Diplotypes[s]);
+		if (s == 0) C.start_transition = curr_dipcount;
+		t += prev_dipcount * curr_dipcount;
+		prev_dipcount = curr_dipcount;
+		for (unsigned int vrel = 0 ; vrel < g->Lengths[s] ; vrel ++) a += VAR_GET_AMB(MOD2(v + vrel), g->Variants[DIV2(v + vrel)]);
+		v += g->Lengths[s];
+		if (v >= n_loci || s == g->n_segments - 1) break;
+	}
+	C.stop_segment = s;
+	C.stop_ambiguous = a - 1;
+	C.stop_locus = v - 1;
+	C.stop_transition = t - 1;
+	return C;
+}
+
+vector < unsigned int > parseList(string str) {
+	vector < string > tokens;
+	vector < unsigned int > values;
+	stb.split(str, tokens, ",");
+	for (int t = 0 ; t < tokens.size() ; t ++) values.push_back(stoi(tokens[t]));
+	return values;
+}
+
+int main(int argc, char ** argv) {
+	bpo::options_description descriptions ("Microbenchmarks of the SHAPEIT4 kernels on synthetic data");
+	descriptions.add_options()
+			("help", "Produce help message")
+			("samples", bpo::value<int>()->default_value(1000), "Number of samples to phase")
+			("refs", bpo::value<int>()->default_value(0), "Number of reference samples")
+			("sites", bpo::value<int>()->default_value(20000), "Number of variant sites")
+			("founders", bpo::value<int>()->default_value(50), "Number of founder haplotypes in the mosaics")
+			("missing", bpo::value<double>()->default_value(0.01), "Missing genotype rate")
+			("K", bpo::value<string>()->default_value("50,100,200,400"), "Numbers of conditioning haplotypes of the HMM grid")
+			("L", bpo::value<string>()->default_value("200,1000,5000"), "Window lengths in variants of the HMM grid")
+			("thread,T", bpo::value<int>()->default_value(1), "Number of threads of the multi-threaded kernels")
+			("seed", bpo::value<int>()->default_value(15052011), "Seed of the random number generator")
+			("min-time", bpo::value<double>()->default_value(0.5), "Minimal time spent on each kernel in seconds")
+			("filter", bpo::value<string>()->default_value(""), "Only run the kernels whose name contains this string")
+			("tmp", bpo::value<string>()->default_value("."), "Directory of the temporary BCF file of the I/O kernels");
+	bpo::variables_map options;
+	try {
+		bpo::store(bpo::command_line_parser(argc, argv).options(descriptions).run(), options);
+		bpo::notify(options);
+	} catch ( const boost::program_options::error& e ) { cerr << "Error parsing command line arguments: " << string(e.what()) << endl; exit(0); }
+	if (options.count("help")) { cout << descriptions << endl; exit(0); }
+
+	//step0: Phaser holding the cohort, with default options
+	int n_thread = options["thread"].as < int > ();
+	vector < string > args = { "--thread", stb.str(n_thread), "--seed", stb.str(options["seed"].as < int > ()) };
+	phaser P;
+	P.declare_options();
+	bpo::store(bpo::command_line_parser(args).options(P.descriptions).run(), P.options);
+	bpo::notify(P.options);
+	vrb.set_silent();
+	P.check_options();
+	rng.setSeed(options["seed"].as < int > ());
+	P.initialise_workers();
+
+	//step1: Synthetic cohort, initialised as for phasing
+	unsigned int n_main = options["samples"].as < int > (), n_ref = options["refs"].as < int > (), n_sites = options["sites"].as < int > ();
+	makeCohort(P, n_main, n_ref, n_sites, options["founders"].as < int > (), options["missing"].as < double > ());
+	P.initialise();
+	P.H.transposeHaplotypes_V2H(false);
+	P.H.updatePBWTmapping();
+	P.H.selectPBWTarrays();
+	cout << "Synthetic cohort [Nm=" << n_main << " / Nr=" << n_ref << " / L=" << n_sites << " / seg=" << P.G.numberOfSegments() << " / T=" << n_thread << "]" << endl;
+
+	bench_runner B (options["min-time"].as < double > (), options["filter"].as < string > ());
+	string cohort = "N=" + stb.str(P.H.n_hap) + " L=" + stb.str(n_sites);
+	double bytes_matrix = P.H.H_opt_hap.n_bytes;
+
+	//step2: Haplotype matrix and PBWT kernels
+	B.run("bitmatrix::transpose", cohort, 2 * bytes_matrix, [&]() { P.H.H_opt_hap.transpose(P.H.H_opt_var, P.H.n_hap, P.H.n_site); });
+	B.run("haplotype_set::selectPBWTarrays", cohort + " E=" + stb.str(P.H.pbwt_evaluated.size()), P.H.pbwt_evaluated.size() * (P.H.n_hap / 8.0), [&]() { P.H.updatePBWTmapping(); P.H.selectPBWTarrays(); });
+	B.run("pbwt_solver::sweep", cohort, bytes_matrix, [&]() { pbwt_solver solver(P.H); solver.sweep(P.G); solver.free(); });
+	B.run("genotype::build", "N=" + stb.str(n_main) + " L=" + stb.str(n_sites), n_main * (n_sites / 2.0), [&]() { builder(P.G, n_thread).build(); });
+
+	//step3: HMM over a grid of K and window lengths, on the first window of the first individual
+	compute_job J(P.V, P.G, P.H, P.G.largestNumberOfTransitions());
+	vector < unsigned int > gridK = parseList(options["K"].as < string > ()), gridL = parseList(options["L"].as < string > ());
+	J.C = vector < coordinates > (1);
+	J.Kvec = vector < vector < unsigned int > > (1);
+	for (int k = 0 ; k < gridK.size() ; k ++) {
+		if (gridK[k] + 2 > P.H.n_hap) continue;
+		for (int w = 0 ; w < gridL.size() ; w ++) {
+			J.C[0] = firstWindow(P.G.vecG[0], gridL[w]);
+			J.Kvec[0].clear();
+			vector < unsigned int > pool;
+			for (unsigned int h = 2 ; h < P.H.n_hap ; h ++) pool.push_back(h);
+			for (unsigned int c = 0 ; c < gridK[k] ; c ++) {
+				unsigned int r = c + rng.getInt(pool.size() - c);
+				std::swap(pool[c], pool[r]);
+				J.Kvec[0].push_back(pool[c]);
+			}
+			sort(J.Kvec[0].begin(), J.Kvec[0].end());
+			J.gather(P.H.H_opt_hap, 0);
+			unsigned int n_loci = J.C[0].stop_locus - J.C[0].start_locus + 1;
+			double bytes_hmm = 2.0 * 2.0 * n_loci * HAP_NUMBER * gridK[k] * sizeof(float);		//Forward and backward messages, read and written at each locus
+			B.run("haplotype_segment::expectation", "K=" + stb.str(gridK[k]) + " L=" + stb.str(n_loci), bytes_hmm, [&]() {
+				haplotype_segment HS(P.G.vecG[0], J.Hwin_var, J.Kvec[0], J.C[0], P.M);
+				if (HS.expectation(J.T) < 0) vrb.error("Underflow impossible to recover");
+			});
+		}
+	}
+
+	//step4: Pruning of a genotype graph, from the transition probabilities of a full HMM pass
+	J.make(0, P.options["window"].as < double > ());
+	for (int w = 0 ; w < J.size() ; w ++) {
+		J.gather(P.H.H_opt_hap, w);
+		haplotype_segment HS(P.G.vecG[0], J.Hwin_var, J.Kvec[w], J.C[w], P.M);
+		if (HS.expectation(J.T) < 0) vrb.error("Underflow impossible to recover");
+	}
+	P.G.vecG[0]->sample(J.T, J.S);
+	B.run("genotype::mapMerges", "seg=" + stb.str(P.G.vecG[0]->n_segments) + " T=" + stb.str(P.G.vecG[0]->n_transitions), P.G.vecG[0]->n_transitions * sizeof(double), [&]() { P.G.vecG[0]->mapMerges(J.T, P.options["mcmc-prune"].as < double > (), J.S); });
+
+	//step5: VCF/BCF throughput, over the size of the compressed file
+	if (B.selected("haplotype_writer::writeHaplotypes") || B.selected("genotype_reader::readGenotypes0")) {
+		string fname = options["tmp"].as < string > () + "/shapeit4_bench.bcf";
+		haplotype_writer(P.H, P.G, P.V).writeHaplotypes(fname);
+		if (bcf_index_build(fname.c_str(), 14) < 0) vrb.error("Impossible to index [" + fname + "]");
+		struct stat st;
+		stat(fname.c_str(), &st);
+		string config = "N=" + stb.str(n_main) + " L=" + stb.str(n_sites) + " " + stb.str(st.st_size / 1048576.0, 1) + "MB";
+		B.run("haplotype_writer::writeHaplotypes", config, st.st_size, [&]() { haplotype_writer(P.H, P.G, P.V).writeHaplotypes(fname); });
+		B.run("genotype_reader::readGenotypes0", config, st.st_size, [&]() {
+			haplotype_set H; genotype_set G; variant_map V;
+			genotype_reader readerG(H, G, V, "1", false);
+			readerG.scanGenotypes(fname);
+			readerG.allocateGenotypes();
+			readerG.readGenotypes0(fname);
+		});
+		remove(fname.c_str());
+		remove((fname + ".csi").c_str());
+	}
+	return 0;
+}
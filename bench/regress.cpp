@@ -0,0 +1,318 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2018 Olivier Delaneau, University of Lausanne
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+#include <api/shapeit4.h>
+#include <utils/otools.h>
+
+#include <iomanip>
+#include <fstream>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+/*
+ * Accuracy versus speed regression harness (make regress, or bin/shapeit4_regress --help). Each
+ * configuration phases each dataset in a forked process through the library, and the switch error
+ * rate against the true haplotypes, the wall time and the peak memory are compared to a baseline
+ * file. The first run writes the baseline; later runs fail when a configuration got less accurate or
+ * slower than the tolerances allow. Compile-time switches such as -DHMM_HALF are checked by running
+ * the same baseline against both builds.
+ */
+
+//Targets are unphased with a random orientation of the true haplotypes, all arrays are variant first
+class regress_data {
+public:
+	string name, map;
+	unsigned int n_main, n_ref;
+	vector < int > bp;
+	vector < signed char > genotypes;
+	vector < unsigned char > truth, reference;
+
+	regress_data(string _name, unsigned int _n_main, unsigned int _n_ref) : name(_name), n_main(_n_main), n_ref(_n_ref) {
+	}
+
+	void push(int pos, const vector < unsigned char > & alleles, double missing_rate) {
+		bp.push_back(pos);
+		for (unsigned int i = 0 ; i < n_main ; i ++) {
+			bool flip = rng.getDouble() < 0.5, mis = rng.getDouble() < missing_rate;
+			truth.push_back(alleles[2*i+0]);
+			truth.push_back(alleles[2*i+1]);
+			genotypes.push_back(mis ? -1 : alleles[2*i+flip]);
+			genotypes.push_back(mis ? -1 : alleles[2*i+1-flip]);
+		}
+		reference.insert(reference.end(), alleles.begin() + 2 * n_main, alleles.begin() + 2 * (n_main + n_ref));
+	}
+
+	unsigned int size() {
+		return bp.size();
+	}
+};
+
+class regress_run {
+public:
+	string dataset, config;
+	double ser, wall;
+	long rss;
+	bool failed;
+};
+
+//Switch errors over the consecutive true hets that are not missing in the input, in %
+double switchErrorRate(regress_data & D, const vector < unsigned char > & phased) {
+	unsigned long n_main_haps = 2UL * D.n_main, n_switch = 0, n_pairs = 0;
+	for (unsigned int i = 0 ; i < D.n_main ; i ++) {
+		int prev = -1;
+		for (unsigned int l = 0 ; l < D.size() ; l ++) {
+			unsigned long o = l * n_main_haps + 2 * i;
+			if (D.truth[o+0] == D.truth[o+1] || D.genotypes[o] < 0) continue;
+			int curr = (phased[o+0] == D.truth[o+0]);
+			if (prev >= 0) { n_switch += (curr != prev); n_pairs ++; }
+			prev = curr;
+		}
+	}
+	return n_pairs ? (n_switch * 100.0 / n_pairs) : 0.0;
+}
+
+//The reference panel of test/ split in targets (first samples) and references, positions and map as in the file
+void readPanel(regress_data & D, string fpanel, double missing_rate) {
+	bcf_srs_t * sr = bcf_sr_init();
+	if (!bcf_sr_add_reader(sr, fpanel.c_str())) vrb.error("Impossible to open [" + fpanel + "]");
+	unsigned int n_samples = bcf_hdr_nsamples(sr->readers[0].header);
+	if (D.n_main >= n_samples) vrb.error("Not enough samples in [" + fpanel + "] for " + stb.str(D.n_main) + " targets");
+	D.n_ref = n_samples - D.n_main;
+	int * gt_arr = NULL, ngt_arr = 0;
+	vector < unsigned char > alleles = vector < unsigned char > (2 * n_samples);
+	while (bcf_sr_next_line(sr)) {
+		bcf1_t * line = bcf_sr_get_line(sr, 0);
+		if (line->n_allele != 2) continue;
+		if (bcf_get_genotypes(sr->readers[0].header, line, &gt_arr, &ngt_arr) != 2 * n_samples) vrb.error("Panel [" + fpanel + "] must be diploid");
+		for (unsigned int h = 0 ; h < 2 * n_samples ; h ++) {
+			if (bcf_gt_is_missing(gt_arr[h])) vrb.error("Panel [" + fpanel + "] must not have missing genotypes");
+			alleles[h] = (bcf_gt_allele(gt_arr[h]) == 1);
+		}
+		D.push(line->pos + 1, alleles, missing_rate);
+	}
+	free(gt_arr);
+	bcf_sr_destroy(sr);
+	if (!D.size()) vrb.error("No biallelic site in [" + fpanel + "]");
+}
+
+//Mosaics of random founders, as for bin/shapeit4_bench
+void makeCohort(regress_data & D, unsigned int n_sites, unsigned int n_founders, double missing_rate) {
+	unsigned long n_haps = 2UL * (D.n_main + D.n_ref);
+	vector < int > founder = vector < int > (n_haps);
+	vector < unsigned char > alleles = vector < unsigned char > (n_haps), founder_alleles = vector < unsigned char > (n_founders);
+	for (unsigned long h = 0 ; h < n_haps ; h ++) founder[h] = rng.getInt(n_founders);
+	for (unsigned int l = 0 ; l < n_sites ; l ++) {
+		double freq = pow(rng.getDouble(), 3.0);
+		for (int f = 0 ; f < n_founders ; f ++) founder_alleles[f] = (rng.getDouble() < freq);
+		for (unsigned long h = 0 ; h < n_haps ; h ++) {
+			if (rng.getDouble() < 0.005) founder[h] = rng.getInt(n_founders);
+			alleles[h] = founder_alleles[founder[h]] ^ (rng.getDouble() < 0.001);
+		}
+		D.push(1 + 100 * l, alleles, missing_rate);
+	}
+}
+
+//Configurations are given as "name option=value option=value ..."
+void parseConfig(string config, string & name, vector < pair < string, string > > & args) {
+	vector < string > tokens;
+	if (config.find_first_not_of(" \t") == string::npos) vrb.error("Empty configuration");
+	stb.split(config, tokens);
+	name = tokens[0];
+	args.clear();
+	for (int t = 1 ; t < tokens.size() ; t ++) {
+		size_t eq = tokens[t].find('=');
+		if (eq == string::npos) vrb.error("Configuration [" + config + "] needs option=value pairs");
+		args.push_back(make_pair(tokens[t].substr(0, eq), tokens[t].substr(eq + 1)));
+	}
+}
+
+//Forked so that each run starts from a fresh heap and gets its own peak memory
+regress_run runConfig(regress_data & D, string config, int seed) {
+	regress_run R;
+	vector < pair < string, string > > args;
+	parseConfig(config, R.config, args);
+	R.dataset = D.name;
+	R.failed = true;
+	R.ser = R.wall = 0.0;
+	R.rss = 0;
+
+	int fd[2];
+	if (pipe(fd) < 0) vrb.error("Impossible to create a pipe");
+	cout.flush();
+	auto t0 = std::chrono::steady_clock::now();
+	pid_t pid = fork();
+	if (pid < 0) vrb.error("Impossible to fork");
+	if (pid == 0) {
+		close(fd[0]);
+		shapeit4 S;
+		S.setOption("seed", stb.str(seed));
+		if (!D.map.empty()) S.setOption("map", D.map);
+		for (int a = 0 ; a < args.size() ; a ++) S.setOption(args[a].first, args[a].second);
+		shapeit4_data I;
+		I.chr = "20";
+		I.n_variants = D.size();
+		I.bp = D.bp.data();
+		I.cm = NULL;
+		I.n_main_samples = D.n_main;
+		I.genotypes = D.genotypes.data();
+		I.n_ref_samples = D.n_ref;
+		I.reference = D.n_ref ? D.reference.data() : NULL;
+		vector < unsigned char > phased = vector < unsigned char > (D.truth.size());
+		S.phase(I, phased.data());
+		double ser = switchErrorRate(D, phased);
+		_exit((write(fd[1], &ser, sizeof(double)) == sizeof(double)) ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
+	close(fd[1]);
+	double ser;
+	bool received = (read(fd[0], &ser, sizeof(double)) == sizeof(double));
+	close(fd[0]);
+	int status;
+	struct rusage usage;
+	if (wait4(pid, &status, 0, &usage) < 0) vrb.error("Impossible to wait for the run [" + D.name + " / " + R.config + "]");
+	R.wall = std::chrono::duration < double > (std::chrono::steady_clock::now() - t0).count();
+	R.rss = usage.ru_maxrss;
+	if (received && WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS) {
+		R.ser = ser;
+		R.failed = false;
+	}
+	return R;
+}
+
+void writeBaseline(string fname, vector < regress_run > & runs) {
+	ofstream fd (fname);
+	if (!fd.good()) vrb.error("Impossible to create [" + fname + "]");
+	fd << setprecision(6);
+	for (int r = 0 ; r < runs.size() ; r ++) if (!runs[r].failed) fd << runs[r].dataset << "\t" << runs[r].config << "\t" << runs[r].ser << "\t" << runs[r].wall << "\t" << runs[r].rss << endl;
+}
+
+int main(int argc, char ** argv) {
+	bpo::options_description descriptions ("Accuracy versus speed regression harness for SHAPEIT4");
+	descriptions.add_options()
+			("help", "Produce help message")
+			("datasets", bpo::value< string >()->default_value("test,synthetic"), "Datasets to phase [test/synthetic]")
+			("config", bpo::value< vector < string > >(), "Configuration as \"name option=value ...\" with the library options, repeatable (default, threads, fast and chunked when absent)")
+			("panel", bpo::value< string >()->default_value("test/reference.bcf"), "Phased panel of the test dataset, its first samples are the targets")
+			("map", bpo::value< string >()->default_value("test/chr20.b37.gmap.gz"), "Genetic map of the test dataset")
+			("test-samples", bpo::value<int>()->default_value(50), "Number of targets taken from the panel of the test dataset")
+			("samples", bpo::value<int>()->default_value(200), "Number of targets of the synthetic dataset")
+			("refs", bpo::value<int>()->default_value(0), "Number of reference samples of the synthetic dataset")
+			("sites", bpo::value<int>()->default_value(10000), "Number of sites of the synthetic dataset (100bp apart)")
+			("founders", bpo::value<int>()->default_value(50), "Number of founder haplotypes of the synthetic dataset")
+			("missing", bpo::value<double>()->default_value(0.01), "Missing target genotype rate")
+			("repeat", bpo::value<int>()->default_value(1), "Number of runs of each configuration, the fastest and smallest ones are kept")
+			("seed", bpo::value<int>()->default_value(15052011), "Seed of the random number generator")
+			("baseline", bpo::value< string >()->default_value("regress.baseline"), "Baseline to compare with, written when it does not exist")
+			("save", bpo::value< string >(), "Write the results of this run as a new baseline")
+			("ser-tolerance", bpo::value<double>()->default_value(0.05), "Maximal increase of the switch error rate, in % points")
+			("time-tolerance", bpo::value<double>()->default_value(0.20), "Maximal relative increase of the wall time")
+			("memory-tolerance", bpo::value<double>()->default_value(0.10), "Maximal relative increase of the peak memory");
+	bpo::variables_map options;
+	try {
+		bpo::store(bpo::command_line_parser(argc, argv).options(descriptions).run(), options);
+		bpo::notify(options);
+	} catch ( const boost::program_options::error& e ) { cerr << "Error parsing command line arguments: " << string(e.what()) << endl; exit(0); }
+	if (options.count("help")) { cout << descriptions << endl; exit(0); }
+
+	vector < string > configs = { "default", "threads thread=4", "fast mcmc-iterations=3b,1p,1b,1p,1b,1p,3m pbwt-depth=2", "chunked chunk-size=0.5 chunk-overlap=0.2" };
+	if (options.count("config")) configs = options["config"].as < vector < string > > ();
+	int seed = options["seed"].as < int > (), n_repeat = options["repeat"].as < int > ();
+	if (n_repeat < 1) vrb.error("You must use at least one run per configuration");
+	rng.setSeed(seed);
+
+	//step0: Datasets
+	vector < string > names;
+	stb.split(options["datasets"].as < string > (), names, ",");
+	vector < regress_data > datasets;
+	for (int d = 0 ; d < names.size() ; d ++) {
+		tac.clock();
+		if (names[d] == "test") {
+			datasets.push_back(regress_data("test", options["test-samples"].as < int > (), 0));
+			datasets.back().map = options["map"].as < string > ();
+			readPanel(datasets.back(), options["panel"].as < string > (), options["missing"].as < double > ());
+		} else if (names[d] == "synthetic") {
+			datasets.push_back(regress_data("synthetic", options["samples"].as < int > (), options["refs"].as < int > ()));
+			makeCohort(datasets.back(), options["sites"].as < int > (), options["founders"].as < int > (), options["missing"].as < double > ());
+		} else vrb.error("Unknown dataset [" + names[d] + "], use test or synthetic");
+		regress_data & D = datasets.back();
+		vrb.bullet("Dataset [" + D.name + "] Nm=" + stb.str(D.n_main) + " / Nr=" + stb.str(D.n_ref) + " / L=" + stb.str(D.size()) + " (" + stb.str(tac.rel_time()*1.0/1000, 2) + "s)");
+	}
+
+	//step1: Baseline, as dataset / configuration / SER / wall / RSS lines
+	string fbaseline = options["baseline"].as < string > ();
+	map < pair < string, string >, regress_run > baseline;
+	ifstream fdb (fbaseline);
+	string line;
+	while (getline(fdb, line)) {
+		regress_run B;
+		istringstream iss (line);
+		if (!(iss >> B.dataset >> B.config >> B.ser >> B.wall >> B.rss)) vrb.error("Malformed line in [" + fbaseline + "]: " + line);
+		baseline[make_pair(B.dataset, B.config)] = B;
+	}
+	bool with_baseline = !baseline.empty();
+
+	//step2: Runs
+	cout << endl << left << setw(12) << "Dataset" << setw(12) << "Config" << right << setw(10) << "SER%" << setw(10) << "base" << setw(10) << "Wall(s)" << setw(10) << "base" << setw(12) << "RSS(MB)" << setw(10) << "base" << "  Status" << endl;
+	vector < regress_run > runs;
+	int n_regressions = 0;
+	for (int d = 0 ; d < datasets.size() ; d ++) {
+		for (int c = 0 ; c < configs.size() ; c ++) {
+			regress_run R = runConfig(datasets[d], configs[c], seed);
+			for (int r = 1 ; r < n_repeat && !R.failed ; r ++) {
+				regress_run Rr = runConfig(datasets[d], configs[c], seed);
+				R.failed = Rr.failed;
+				R.wall = min(R.wall, Rr.wall);
+				R.rss = min(R.rss, Rr.rss);
+			}
+			runs.push_back(R);
+
+			string status = "ok";
+			auto it = baseline.find(make_pair(R.dataset, R.config));
+			bool found = (it != baseline.end());
+			if (R.failed) status = "FAILED";
+			else if (with_baseline && !found) status = "new";
+			else if (found) {
+				vector < string > reasons;
+				if (R.ser > it->second.ser + options["ser-tolerance"].as < double > ()) reasons.push_back("accuracy");
+				if (R.wall > it->second.wall * (1.0 + options["time-tolerance"].as < double > ())) reasons.push_back("time");
+				if (R.rss > it->second.rss * (1.0 + options["memory-tolerance"].as < double > ())) reasons.push_back("memory");
+				if (!reasons.empty()) status = "REGRESSION (" + stb.str(reasons) + ")";
+			}
+			if (status != "ok" && status != "new") n_regressions ++;
+			cout << left << setw(12) << R.dataset << setw(12) << R.config << right << fixed;
+			cout << setw(10) << setprecision(3) << R.ser << setw(10) << (found ? stb.str(it->second.ser, 3) : "-");
+			cout << setw(10) << setprecision(2) << R.wall << setw(10) << (found ? stb.str(it->second.wall, 2) : "-");
+			cout << setw(12) << setprecision(1) << R.rss / 1024.0 << setw(10) << (found ? stb.str(it->second.rss / 1024.0, 1) : "-");
+			cout << "  " << status << endl;
+		}
+	}
+	cout << endl;
+
+	//step3: Verdict
+	if (options.count("save")) writeBaseline(options["save"].as < string > (), runs);
+	if (!with_baseline) {
+		writeBaseline(fbaseline, runs);
+		vrb.bullet("No baseline, results written in [" + fbaseline + "]");
+	}
+	if (n_regressions) vrb.error(stb.str(n_regressions) + " run(s) failed or regressed beyond the tolerances");
+	vrb.bullet("No regression");
+	return 0;
+}
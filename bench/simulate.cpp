@@ -0,0 +1,287 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2018 Olivier Delaneau, University of Lausanne
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+#include <utils/otools.h>
+
+/*
+ * Generator of synthetic cohorts for scaling tests (make bench, then bin/shapeit4_simulate --help).
+ * Haplotypes are mosaics of the haplotypes of a seed panel (e.g. test/reference.bcf), or of random
+ * founders without panel: each one copies a seed haplotype and switches to another one at the rate
+ * given by --switch-rate, with rare mutations on top. Everything is generated one site at a time so
+ * that memory does not grow with the number of sites.
+ */
+
+//Number of failures before the first success of a Bernoulli(p) process
+unsigned long geometric(double p) {
+	if (p <= 0.0) return numeric_limits < unsigned long >::max();
+	if (p >= 1.0) return 0;
+	double u = rng.getDouble();
+	while (u <= 0.0) u = rng.getDouble();
+	return (unsigned long)floor(log(u) / log(1.0 - p));
+}
+
+double exponential(double rate) {
+	double u = rng.getDouble();
+	while (u <= 0.0) u = rng.getDouble();
+	return -log(u) / rate;
+}
+
+class vcf_output {
+public:
+	string fname;
+	htsFile * fp;
+	bcf_hdr_t * hdr;
+	bcf1_t * rec;
+	vector < int > genotypes;
+	vector < int > phasesets;
+	bool indexed;
+
+	vcf_output(string _fname, string chr, string prefix, unsigned int n_samples, bool with_PS) : fname(_fname) {
+		string mode = "w";
+		if (fname.size() > 6 && fname.substr(fname.size()-6) == "vcf.gz") mode = "wz";
+		if (fname.size() > 3 && fname.substr(fname.size()-3) == "bcf") mode = "wb";
+		indexed = (mode != "w");
+		fp = hts_open(fname.c_str(), mode.c_str());
+		if (!fp) vrb.error("Impossible to create [" + fname + "]");
+		hdr = bcf_hdr_init("w");
+		rec = bcf_init1();
+		bcf_hdr_append(hdr, string("##fileDate="+tac.date()).c_str());
+		bcf_hdr_append(hdr, "##source=shapeit4_simulate");
+		bcf_hdr_append(hdr, string("##contig=<ID=" + chr + ">").c_str());
+		bcf_hdr_append(hdr, "##FORMAT=<ID=GT,Number=1,Type=String,Description=\"Genotype\">");
+		if (with_PS) bcf_hdr_append(hdr, "##FORMAT=<ID=PS,Number=1,Type=Integer,Description=\"Phase set\">");
+		for (unsigned int i = 0 ; i < n_samples ; i ++) bcf_hdr_add_sample(hdr, (prefix + stb.str(i)).c_str());
+		bcf_hdr_add_sample(hdr, NULL);
+		if (bcf_hdr_write(fp, hdr) < 0) vrb.error("Impossible to write header of [" + fname + "]");
+		genotypes = vector < int > (2 * n_samples);
+		if (with_PS) phasesets = vector < int > (n_samples);
+	}
+
+	void write(string chr, int bp, string alleles) {
+		bcf_clear1(rec);
+		rec->rid = bcf_hdr_name2id(hdr, chr.c_str());
+		rec->pos = bp - 1;
+		bcf_update_alleles_str(hdr, rec, alleles.c_str());
+		bcf_update_genotypes(hdr, rec, genotypes.data(), genotypes.size());
+		if (phasesets.size()) bcf_update_format_int32(hdr, rec, "PS", phasesets.data(), phasesets.size());
+		if (bcf_write1(fp, hdr, rec) < 0) vrb.error("Impossible to write in [" + fname + "]");
+	}
+
+	//Indexed so that SHAPEIT can jump to the region
+	void close() {
+		bcf_destroy1(rec);
+		bcf_hdr_destroy(hdr);
+		if (hts_close(fp)) vrb.error("Non zero status when closing [" + fname + "]");
+		if (indexed && bcf_index_build(fname.c_str(), 14) < 0) vrb.error("Impossible to index [" + fname + "]");
+	}
+};
+
+int main(int argc, char ** argv) {
+	bpo::options_description descriptions ("Synthetic cohort generator for SHAPEIT4 scaling tests");
+	descriptions.add_options()
+			("help", "Produce help message")
+			("panel", bpo::value< string >(), "Seed panel of phased haplotypes in VCF/BCF format (random founders when absent)")
+			("region", bpo::value< string >(), "Region of the seed panel to use")
+			("samples", bpo::value<int>()->default_value(1000), "Number of target samples")
+			("refs", bpo::value<int>()->default_value(0), "Number of reference samples")
+			("sites", bpo::value<int>()->default_value(0), "Number of sites (0 means all the sites of the seed panel, required without panel)")
+			("founders", bpo::value<int>()->default_value(100), "Number of random founder haplotypes without seed panel")
+			("chr", bpo::value< string >()->default_value("1"), "Chromosome name without seed panel (sites are 100bp apart)")
+			("switch-rate", bpo::value<double>()->default_value(2.0), "Rate at which haplotypes switch of copied seed haplotype, per Mb")
+			("mutation", bpo::value<double>()->default_value(0.0005), "Probability that a copied allele is flipped")
+			("error", bpo::value<double>()->default_value(0.0), "Probability that a target allele is flipped in the genotypes, not in the truth (raises the het rate)")
+			("missing", bpo::value<double>()->default_value(0.0), "Missing target genotype rate")
+			("ps-length", bpo::value<int>()->default_value(0), "Mean length in sites of the phase sets (PS field) of the target hets, 0 means no PS field")
+			("ps-fraction", bpo::value<double>()->default_value(1.0), "Fraction of the targets with phase sets")
+			("ps-error", bpo::value<double>()->default_value(0.0), "Switch error rate per het within phase sets")
+			("ibd2-pairs", bpo::value<int>()->default_value(0), "Number of target pairs sharing both haplotypes over a stretch")
+			("ibd2-length", bpo::value<double>()->default_value(5.0), "Length of the IBD2 stretches in Mb")
+			("seed", bpo::value<int>()->default_value(15052011), "Seed of the random number generator")
+			("output", bpo::value< string >(), "Target genotypes in VCF/BCF format (unphased, or phased within PS)")
+			("output-ref", bpo::value< string >(), "Reference haplotypes in VCF/BCF format")
+			("output-truth", bpo::value< string >(), "True target haplotypes in VCF/BCF format");
+	bpo::variables_map options;
+	try {
+		bpo::store(bpo::command_line_parser(argc, argv).options(descriptions).run(), options);
+		bpo::notify(options);
+	} catch ( const boost::program_options::error& e ) { cerr << "Error parsing command line arguments: " << string(e.what()) << endl; exit(0); }
+	if (options.count("help")) { cout << descriptions << endl; exit(0); }
+
+	int n_main = options["samples"].as < int > (), n_ref = options["refs"].as < int > (), n_sites = options["sites"].as < int > ();
+	if (!options.count("output")) vrb.error("You must specify the target genotypes file with --output");
+	if (n_main < 1 || n_ref < 0) vrb.error("You must specify at least one target sample and a positive number of reference samples");
+	if (n_ref > 0 && !options.count("output-ref")) vrb.error("You must specify the reference file with --output-ref");
+	if (!options.count("panel") && n_sites < 1) vrb.error("You must specify a number of sites with --sites when there is no seed panel");
+	if (2 * options["ibd2-pairs"].as < int > () > n_main) vrb.error("Not enough target samples for the IBD2 pairs");
+	rng.setSeed(options["seed"].as < int > ());
+	tac.clock();
+
+	//step0: Seed panel, read one site at a time
+	bcf_srs_t * sr = NULL;
+	int n_seed = options["founders"].as < int > () * 2;
+	string chr = options["chr"].as < string > ();
+	int * gt_arr = NULL, ngt_arr = 0;
+	if (options.count("panel")) {
+		string fpanel = options["panel"].as < string > ();
+		sr = bcf_sr_init();
+		if (options.count("region") && bcf_sr_set_regions(sr, options["region"].as < string > ().c_str(), 0) == -1) vrb.error("Impossible to jump to region in [" + fpanel + "]");
+		if (!bcf_sr_add_reader(sr, fpanel.c_str())) vrb.error("Impossible to open [" + fpanel + "]");
+		n_seed = 2 * bcf_hdr_nsamples(sr->readers[0].header);
+		if (n_seed < 2) vrb.error("No haplotypes in the seed panel [" + fpanel + "]");
+	}
+	vector < unsigned char > seed = vector < unsigned char > (n_seed);
+
+	//step1: Outputs
+	vcf_output * O = NULL, * R = NULL, * T = NULL;
+	bool with_PS = options["ps-length"].as < int > () > 0;
+
+	//step2: Copying state of each haplotype (targets first, then references)
+	unsigned long n_haps = 2UL * (n_main + n_ref), n_main_haps = 2UL * n_main;
+	vector < int > source = vector < int > (n_haps);
+	vector < double > next_switch = vector < double > (n_haps, 0.0);
+	vector < unsigned char > alleles = vector < unsigned char > (n_haps), observed = vector < unsigned char > (n_main_haps), missing = vector < unsigned char > (n_main);
+	double switch_rate = options["switch-rate"].as < double > () / 1e6;
+
+	//IBD2: the second sample of a pair copies both haplotypes of the first one within [start, stop]
+	vector < int > ibd2_first, ibd2_second;
+	vector < double > ibd2_start, ibd2_stop;
+	vector < int > perm (n_main);
+	for (int i = 0 ; i < n_main ; i ++) perm[i] = i;
+	for (int p = 0 ; p < options["ibd2-pairs"].as < int > () ; p ++) {
+		for (int k = 0 ; k < 2 ; k ++) std::swap(perm[2*p+k], perm[2*p+k + rng.getInt(n_main - 2*p - k)]);
+		ibd2_first.push_back(perm[2*p+0]);
+		ibd2_second.push_back(perm[2*p+1]);
+	}
+
+	//PS: hets are phased within blocks broken every ps-length sites on average, with switch errors
+	double ps_break = with_PS ? 1.0 / options["ps-length"].as < int > () : 0.0, ps_error = options["ps-error"].as < double > ();
+	vector < bool > ps_active = vector < bool > (n_main, false), ps_flip = vector < bool > (n_main, false);
+	vector < int > ps_block = vector < int > (n_main, 0);
+	vector < unsigned long > ps_next_break = vector < unsigned long > (n_main, 0);
+	for (int i = 0 ; i < n_main && with_PS ; i ++) {
+		ps_active[i] = (rng.getDouble() < options["ps-fraction"].as < double > ());
+		ps_next_break[i] = geometric(ps_break);
+	}
+
+	unsigned long n_written = 0, n_het = 0, n_mis = 0, n_phased = 0;
+	int bp0 = -1, bp1 = -1;
+	for (unsigned long l = 0 ; n_sites == 0 || l < n_sites ; l ++) {
+		//step3: Seed alleles at this site
+		int bp = 1 + 100 * l;
+		string alleles_str = "A,C";
+		if (sr) {
+			bcf1_t * line = NULL;
+			while ((line = bcf_sr_next_line(sr) ? bcf_sr_get_line(sr, 0) : NULL) != NULL && line->n_allele != 2);
+			if (!line) break;
+			bcf_unpack(line, BCF_UN_STR);
+			chr = bcf_hdr_id2name(sr->readers[0].header, line->rid);
+			bp = line->pos + 1;
+			alleles_str = string(line->d.allele[0]) + "," + string(line->d.allele[1]);
+			int ngt = bcf_get_genotypes(sr->readers[0].header, line, &gt_arr, &ngt_arr);
+			if (ngt != n_seed) vrb.error("Seed panel must be diploid");
+			for (int h = 0 ; h < n_seed ; h ++) seed[h] = (bcf_gt_allele(gt_arr[h]) == 1);
+		} else {
+			double freq = pow(rng.getDouble(), 3.0);
+			for (int h = 0 ; h < n_seed ; h ++) seed[h] = (rng.getDouble() < freq);
+		}
+		if (bp0 < 0) {
+			bp0 = bp;
+			for (int p = 0 ; p < ibd2_first.size() ; p ++) {
+				ibd2_start.push_back(bp0 + rng.getDouble() * (n_sites ? (100.0 * n_sites) : 50e6));
+				ibd2_stop.push_back(ibd2_start.back() + options["ibd2-length"].as < double > () * 1e6);
+			}
+		}
+
+		//step4: Mosaic copying and mutations
+		for (unsigned long h = 0 ; h < n_haps ; h ++) {
+			if (bp >= next_switch[h]) {
+				source[h] = rng.getInt(n_seed);
+				next_switch[h] = bp + exponential(switch_rate);
+			}
+			alleles[h] = seed[source[h]];
+		}
+		for (unsigned long h = geometric(options["mutation"].as < double > ()) ; h < n_haps ; h += 1 + geometric(options["mutation"].as < double > ())) alleles[h] ^= 1;
+		for (int p = 0 ; p < ibd2_first.size() ; p ++) if (bp >= ibd2_start[p] && bp <= ibd2_stop[p]) {
+			alleles[2*ibd2_second[p]+0] = alleles[2*ibd2_first[p]+0];
+			alleles[2*ibd2_second[p]+1] = alleles[2*ibd2_first[p]+1];
+		}
+
+		//step5: Observed target genotypes
+		std::copy(alleles.begin(), alleles.begin() + n_main_haps, observed.begin());
+		std::fill(missing.begin(), missing.end(), 0);
+		for (unsigned long h = geometric(options["error"].as < double > ()) ; h < n_main_haps ; h += 1 + geometric(options["error"].as < double > ())) observed[h] ^= 1;
+		for (unsigned long i = geometric(options["missing"].as < double > ()) ; i < n_main ; i += 1 + geometric(options["missing"].as < double > ())) missing[i] = 1;
+
+		//step6: Write the site
+		if (!O) {
+			O = new vcf_output(options["output"].as < string > (), chr, "target", n_main, with_PS);
+			if (n_ref) R = new vcf_output(options["output-ref"].as < string > (), chr, "reference", n_ref, false);
+			if (options.count("output-truth")) T = new vcf_output(options["output-truth"].as < string > (), chr, "target", n_main, false);
+		}
+		for (int i = 0 ; i < n_main ; i ++) {
+			bool a0 = observed[2*i+0], a1 = observed[2*i+1], het = (a0 != a1) && !missing[i];
+			bool phased = false;
+			if (with_PS) {
+				if (ps_next_break[i] == 0) { ps_block[i] = 0; ps_next_break[i] = geometric(ps_break); }
+				else ps_next_break[i] --;
+				O->phasesets[i] = bcf_int32_missing;
+				if (het && ps_active[i]) {
+					if (ps_block[i] == 0) { ps_block[i] = bp; ps_flip[i] = false; }
+					else if (ps_error > 0 && rng.getDouble() < ps_error) ps_flip[i] = !ps_flip[i];
+					if (ps_flip[i]) std::swap(a0, a1);
+					O->phasesets[i] = ps_block[i];
+					phased = true;
+				}
+			}
+			if (missing[i]) O->genotypes[2*i+0] = O->genotypes[2*i+1] = bcf_gt_missing;
+			else if (phased) { O->genotypes[2*i+0] = bcf_gt_phased(a0); O->genotypes[2*i+1] = bcf_gt_phased(a1); }
+			else { O->genotypes[2*i+0] = bcf_gt_unphased(a0); O->genotypes[2*i+1] = bcf_gt_unphased(a1); }
+			n_het += het;
+			n_mis += missing[i];
+			n_phased += phased;
+			if (T) { T->genotypes[2*i+0] = bcf_gt_phased(alleles[2*i+0]); T->genotypes[2*i+1] = bcf_gt_phased(alleles[2*i+1]); }
+		}
+		for (int i = 0 ; i < n_ref ; i ++) {
+			R->genotypes[2*i+0] = bcf_gt_phased(alleles[n_main_haps + 2*i+0]);
+			R->genotypes[2*i+1] = bcf_gt_phased(alleles[n_main_haps + 2*i+1]);
+		}
+		O->write(chr, bp, alleles_str);
+		if (R) R->write(chr, bp, alleles_str);
+		if (T) T->write(chr, bp, alleles_str);
+		n_written ++;
+		bp1 = bp;
+		if (n_sites) vrb.progress("  * Simulation", (l+1)*1.0/n_sites);
+	}
+	if (sr) bcf_sr_destroy(sr);
+	free(gt_arr);
+	if (!O) vrb.error("No biallelic site in the seed panel");
+	O->close(); delete O;
+	if (R) { R->close(); delete R; }
+	if (T) { T->close(); delete T; }
+
+	vrb.title("Synthetic cohort:");
+	vrb.bullet("Seed    : " + (options.count("panel") ? ("[" + options["panel"].as < string > () + "] / " + stb.str(n_seed) + " haplotypes") : (stb.str(n_seed) + " random founder haplotypes")));
+	vrb.bullet("Samples : Nm=" + stb.str(n_main) + " / Nr=" + stb.str(n_ref) + " / L=" + stb.str(n_written) + " / Reg=" + chr + ":" + stb.str(bp0) + "-" + stb.str(bp1));
+	double n_geno = n_written * 1.0 * n_main;
+	vrb.bullet("Targets : Het=" + stb.str(n_het * 100.0 / n_geno, 2) + "% / Mis=" + stb.str(n_mis * 100.0 / n_geno, 2) + "% / Pha=" + stb.str(n_phased * 100.0 / n_geno, 2) + "% / IBD2 pairs=" + stb.str(ibd2_first.size()));
+	vrb.bullet("Time    : " + stb.str(tac.rel_time() * 1.0 / 1000, 2) + "s");
+	return 0;
+}
@@ -0,0 +1,138 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2018 Olivier Delaneau, University of Lausanne
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+#include <api/shapeit4.h>
+#include <phaser/phaser_header.h>
+
+shapeit4::shapeit4() {
+}
+
+shapeit4::~shapeit4() {
+	args.clear();
+}
+
+void shapeit4::setOption(const string & name, const string & value) {
+	args.push_back("--" + name);
+	args.push_back(value);
+}
+
+/*
+ * Fills the containers of a phaser from the caller arrays, the same way genotype_reader does from VCF/BCF
+ * files, then runs the usual initialisation, MCMC and finalisation steps.
+ */
+void shapeit4::phase(const shapeit4_data & D, unsigned char * haplotypes) {
+	phaser P;
+	P.declare_options();
+	try {
+		bpo::store(bpo::command_line_parser(args).options(P.descriptions).run(), P.options);
+		bpo::notify(P.options);
+	} catch ( const boost::program_options::error& e ) { vrb.error("Error parsing options: " + string(e.what())); }
+	if (P.options.count("log") && !vrb.open_log(P.options["log"].as < string > ()))
+		vrb.error("Impossible to create log file [" + P.options["log"].as < string > () +"]");
+	vrb.set_silent();
+	P.check_options();
+	P.initialise_reports();
+	if (D.n_variants == 0 || D.n_main_samples == 0) vrb.error("No variants or samples to be phased");
+	if (D.n_ref_samples > 0 && D.reference == NULL) vrb.error("Reference haplotypes are missing");
+	if (P.options.count("use-PS") || P.options.count("scaffold")) vrb.error("--use-PS and --scaffold are not supported by the library");
+
+	//step0: Initialize seed and multi-threading
+	vrb.title("Initialization:");
+	int n_thread = P.options["thread"].as < int > ();
+	rng.setSeed(P.options["seed"].as < int > ());
+	P.initialise_workers();
+
+	//step1: Decode the caller arrays
+	tac.clock();
+	unsigned long n_main_haps = 2UL * D.n_main_samples, n_ref_haps = 2UL * D.n_ref_samples;
+	string ooc_dir = P.options.count("out-of-core")?P.options["out-of-core"].as < string > ():"";
+	P.G.allocate(D.n_main_samples, D.n_variants);
+	for (int i = 0 ; i < D.n_main_samples ; i ++) P.G.vecG[i]->name = "sample" + stb.str(i);
+	P.H.n_ind = D.n_main_samples;
+	P.H.n_hap = n_main_haps + n_ref_haps;
+	P.H.n_site = D.n_variants;
+	P.H.H_opt_var.allocate(P.H.n_site, P.H.n_hap, ooc_dir);
+	P.H.H_opt_hap.allocate(P.H.n_hap, P.H.n_site, ooc_dir);
+	string chr = D.chr, id = ".", ref = "A", alt = "C";
+	for (unsigned int l = 0 ; l < D.n_variants ; l ++) {
+		if (l && D.bp[l] < D.bp[l-1]) vrb.error("Variants must be sorted by position [" + stb.str(D.bp[l]) + "]");
+		variant * newV = new variant (chr, D.bp[l], id, ref, alt, P.V.size());
+		unsigned int cref = 0, calt = 0, cmis = 0;
+		const signed char * gt = D.genotypes + l * n_main_haps;
+		for (unsigned int i = 0 ; i < D.n_main_samples ; i ++) {
+			bool a0 = (gt[2*i+0] == 1);
+			bool a1 = (gt[2*i+1] == 1);
+			bool mi = (gt[2*i+0] < 0 || gt[2*i+1] < 0);
+			bool he = !mi && a0 != a1;
+			if (a0) VAR_SET_HAP0(MOD2(l), P.G.vecG[i]->Variants[DIV2(l)]);
+			if (a1) VAR_SET_HAP1(MOD2(l), P.G.vecG[i]->Variants[DIV2(l)]);
+			if (mi) VAR_SET_MIS(MOD2(l), P.G.vecG[i]->Variants[DIV2(l)]);
+			if (he) VAR_SET_HET(MOD2(l), P.G.vecG[i]->Variants[DIV2(l)]);
+			if (!mi) { a0?calt++:cref++; a1?calt++:cref++; }
+			else cmis ++;
+		}
+		const unsigned char * rh = D.reference + l * n_ref_haps;
+		for (unsigned int h = 0 ; h < n_ref_haps ; h ++) {
+			bool a = (rh[h] == 1);
+			P.H.H_opt_hap.set(n_main_haps + h, l, a);
+			a?calt++:cref++;
+		}
+		newV->cref = cref;newV->calt = calt;newV->cmis = cmis;
+		if (D.cm) newV->cm = D.cm[l];
+		P.V.push(newV);
+	}
+	vrb.bullet("Memory decoding [Nm=" + stb.str(D.n_main_samples) + " / Nr=" + stb.str(D.n_ref_samples) + " / L=" + stb.str(D.n_variants) + "] (" + stb.str(tac.rel_time()*1.0/1000, 2) + "s)");
+	P.G.imputeMonomorphic(P.V, n_thread);
+
+	//step2: Genetic positions
+	if (D.cm) {
+		double baseline = P.V.vec_pos[0]->cm;
+		for (int l = 0 ; l < P.V.size() ; l ++) P.V.vec_pos[l]->cm -= baseline;
+	} else if (P.options.count("map")) {
+		gmap_reader readerGM;
+		readerGM.readGeneticMapFile(P.options["map"].as < string > ());
+		P.V.setGeneticMap(readerGM);
+	} else P.V.setGeneticMap();
+
+	//step3: Phasing, as phaser::phase(vector < string > &) without the VCF/BCF round trip
+	if (P.options.count("chunk-size")) {
+		P.makeChunks();
+		P.phaseChunks();
+	} else {
+		P.initialise();
+		P.phase();
+	}
+	vrb.title("Finalization:");
+	if (n_thread > 1) pthread_mutex_destroy(&P.mutex_workers);
+	if (P.options.count("chunk-size")) P.ligateChunks();
+	else P.finalise();
+
+	//step4: Copy the phased main haplotypes into the caller buffer
+	for (unsigned int l = 0 ; l < D.n_variants ; l ++)
+		for (unsigned long h = 0 ; h < n_main_haps ; h ++)
+			haplotypes[l * n_main_haps + h] = P.H.H_opt_var.get(l, h);
+	vrb.bullet("Total running time = " + stb.str(tac.abs_time()) + " seconds");
+	if (P.options.count("report")) P.write_report(P.options["report"].as < string > ());
+	if (P.options.count("trace")) P.write_trace(P.options["trace"].as < string > ());
+#ifdef HMM_COUNTERS
+	P.hmm_profile.print();
+#endif
+}
@@ -0,0 +1,62 @@
+/*******************************************************************************
+ * Copyright (C) 2018 Olivier Delaneau, University of Lausanne
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#ifndef _SHAPEIT4_H
+#define _SHAPEIT4_H
+
+#include <string>
+#include <vector>
+
+/*
+ * In-memory input of the library. All arrays are variant first and owned by the caller.
+ * Alleles are 0 (REF) or 1 (ALT); main genotypes use -1 for missing alleles.
+ */
+struct shapeit4_data {
+	std::string chr;							// Chromosome name
+	unsigned int n_variants;					// #variants, sorted by position
+	const int * bp;								// Positions in bp [n_variants]
+	const double * cm;							// Positions in cM [n_variants], NULL for the --map option or 1cM per Mb
+	unsigned int n_main_samples;				// #samples to phase
+	const signed char * genotypes;				// Unphased genotypes [n_variants x 2*n_main_samples]
+	unsigned int n_ref_samples;					// #reference samples, 0 without reference panel
+	const unsigned char * reference;			// Reference haplotypes [n_variants x 2*n_ref_samples]
+};
+
+/*
+ * Library entry point (libshapeit4). Options are the command line ones, without the file options, e.g.
+ * setOption("thread", "8") or setOption("mcmc-iterations", "10b,1p,1b,1p,1b,1p,10m"). Phasing writes the
+ * phased main haplotypes in a caller buffer of n_variants x 2*n_main_samples bytes, laid out as genotypes.
+ * As in the binary, invalid options or data end the process with an error message.
+ */
+class shapeit4 {
+public:
+	std::vector < std::string > args;
+
+	//CONSTRUCTOR
+	shapeit4();
+	~shapeit4();
+
+	//METHODS
+	void setOption(const std::string & name, const std::string & value);
+	void phase(const shapeit4_data & D, unsigned char * haplotypes);
+};
+
+#endif
@@ -23,6 +23,12 @@
 #define _BITMATRIX_H
 
 #include <utils/otools.h>
+#include <utils/huge_pages.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#define BITMATRIX_PREFETCH_ROWS	256		//Rows read ahead at once by out-of-core site-major walks
 
 inline static unsigned int abracadabra(const unsigned int &i1, const unsigned int &i2) {
 	return static_cast<unsigned int>((static_cast<unsigned long int>(i1) * static_cast<unsigned long int>(i2)) >> 32);
@@ -32,29 +38,66 @@ class bitmatrix	{
 public:
 	unsigned long int n_bytes, n_cols, n_rows;
 	unsigned char * bytes;
+	int fd;				//File backing the matrix when out-of-core, -1 otherwise
 
 	bitmatrix() {
 		n_rows = 0;
 		n_cols = 0;
 		n_bytes = 0;
 		bytes = NULL;
+		fd = -1;
 	}
 
 	void allocate(unsigned int nrow, unsigned int ncol) {
 		n_rows = nrow + ((nrow%8)?(8-(nrow%8)):0);
 		n_cols = ncol + ((ncol%8)?(8-(ncol%8)):0);
 		n_bytes = (n_cols/8) * (unsigned long)n_rows;
-		bytes = (unsigned char*)malloc(n_bytes*sizeof(unsigned char));
-		memset(bytes, 0, n_bytes);
+		bytes = (unsigned char*)huge_alloc(n_bytes*sizeof(unsigned char));
+		if (bytes == NULL) vrb.error("Impossible to allocate a bit matrix of " + stb.str(n_bytes) + " bytes");
+	}
+
+	/*
+	 * Out-of-core version: the matrix is a shared mapping of an unlinked temporary file in [dir],
+	 * so that only the pages being walked need to be resident. Layout and accessors are unchanged.
+	 */
+	void allocate(unsigned int nrow, unsigned int ncol, string dir) {
+		if (dir.empty()) return allocate(nrow, ncol);
+		n_rows = nrow + ((nrow%8)?(8-(nrow%8)):0);
+		n_cols = ncol + ((ncol%8)?(8-(ncol%8)):0);
+		n_bytes = (n_cols/8) * (unsigned long)n_rows;
+		string tmpl = dir + "/shapeit4_bitmatrix_XXXXXX";
+		vector < char > fname (tmpl.begin(), tmpl.end());
+		fname.push_back('\0');
+		fd = mkstemp(fname.data());
+		if (fd < 0) vrb.error("Impossible to create a temporary file in [" + dir + "]");
+		unlink(fname.data());
+		if (ftruncate(fd, n_bytes) != 0) vrb.error("Impossible to extend a temporary file to " + stb.str(n_bytes) + " bytes in [" + dir + "]");
+		bytes = (unsigned char*)mmap(NULL, n_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if ((void*)bytes == MAP_FAILED) vrb.error("Impossible to map a temporary file of " + stb.str(n_bytes) + " bytes in [" + dir + "]");
 	}
 
 	~bitmatrix() {
+		free();
+	}
+
+	void free() {
+		if (bytes != NULL && fd >= 0) munmap(bytes, n_bytes);
+		else if (bytes != NULL) huge_free(bytes, n_bytes);
+		if (fd >= 0) close(fd);
+		fd = -1;
+		n_rows = 0;
+		n_cols = 0;
 		n_bytes = 0;
-		if (bytes != NULL) free(bytes);
+		bytes = NULL;
 	}
 
 	void set(unsigned int row, unsigned int col, unsigned char bit);
 	unsigned char get(unsigned int row, unsigned int col);
+	void unpack(unsigned int row, unsigned int ncol, unsigned char * out);
+	uint64_t getWord(unsigned int row, unsigned int word);
+	void gather(bitmatrix & src, vector < unsigned int > & rows, unsigned int col0, unsigned int ncol);
+	void prefetch(unsigned int row0, unsigned int row1);
+	void prefetch(unsigned int row, unsigned int col0, unsigned int col1);
 
 
 	/*
@@ -104,4 +147,84 @@ unsigned char bitmatrix::get(unsigned int row, unsigned int col) {
 	return result;
 }
 
+/*
+ * Unpacks the first ncol bits of a row into one byte per bit, reading 64 bits at a time.
+ */
+inline
+void bitmatrix::unpack(unsigned int row, unsigned int ncol, unsigned char * out) {
+	const unsigned char * src = this->bytes + ((unsigned long)row) * (n_cols/8);
+	unsigned int col = 0;
+	for (; col + 64 <= ncol ; col += 64) {
+		uint64_t word;
+		memcpy(&word, src + col/8, sizeof(uint64_t));
+		word = __builtin_bswap64(word);
+		for (unsigned int b = 0 ; b < 64 ; b ++) out[col+b] = (word >> (63 - b)) & 1UL;
+	}
+	for (; col < ncol ; col ++) out[col] = (src[col/8] >> (7 - (col%8))) & 1;
+}
+
+/*
+ * Returns columns [64*word, 64*word+63] of a row, first column in the most significant bit.
+ */
+inline
+uint64_t bitmatrix::getWord(unsigned int row, unsigned int word) {
+	const unsigned char * src = this->bytes + ((unsigned long)row) * (n_cols/8) + word * 8UL;
+	unsigned long n_avail = n_cols/8 - word * 8UL;
+	uint64_t result = 0;
+	if (n_avail >= 8) {
+		memcpy(&result, src, sizeof(uint64_t));
+		return __builtin_bswap64(result);
+	}
+	for (unsigned long b = 0 ; b < n_avail ; b ++) result |= ((uint64_t)src[b]) << (56 - 8 * b);
+	return result;
+}
+
+/*
+ * Copies columns [col0, col0+ncol) of the given rows of src into the first rows of this matrix, starting at column 0.
+ * Reads src 64 bits at a time; columns beyond ncol in the last word are left unspecified.
+ */
+inline
+void bitmatrix::gather(bitmatrix & src, vector < unsigned int > & rows, unsigned int col0, unsigned int ncol) {
+	unsigned int word0 = col0 / 64, shift = col0 % 64, n_words = (ncol + 63) / 64, src_words = (src.n_cols + 63) / 64;
+	unsigned long n_dst = n_cols/8;
+	for (unsigned int k = 0 ; k < rows.size() ; k ++) {
+		unsigned char * dst = this->bytes + ((unsigned long)k) * n_dst;
+		uint64_t curr = src.getWord(rows[k], word0);
+		for (unsigned int w = 0 ; w < n_words ; w ++) {
+			uint64_t next = (word0 + w + 1 < src_words) ? src.getWord(rows[k], word0 + w + 1) : 0;
+			uint64_t word = shift ? ((curr << shift) | (next >> (64 - shift))) : curr;
+			unsigned long n_avail = min(8UL, n_dst - 8UL * w);
+			if (n_avail == 8) {
+				word = __builtin_bswap64(word);
+				memcpy(dst + 8UL * w, &word, sizeof(uint64_t));
+			} else for (unsigned long b = 0 ; b < n_avail ; b ++) dst[8UL * w + b] = (word >> (56 - 8 * b)) & 0xFF;
+			curr = next;
+		}
+	}
+}
+
+/*
+ * Out-of-core only: asks the kernel to read ahead rows [row0, row1) (site-major walk of the PBWT passes).
+ */
+inline
+void bitmatrix::prefetch(unsigned int row0, unsigned int row1) {
+	if (fd < 0 || row1 <= row0) return;
+	unsigned long page = sysconf(_SC_PAGESIZE);
+	unsigned long start = ((unsigned long)row0) * (n_cols/8);
+	unsigned long stop = min(n_bytes, ((unsigned long)row1) * (n_cols/8));
+	madvise(bytes + (start & ~(page - 1)), stop - (start & ~(page - 1)), MADV_WILLNEED);
+}
+
+/*
+ * Out-of-core only: asks the kernel to read ahead columns [col0, col1) of a row (haplotype-major walk of the HMM windows).
+ */
+inline
+void bitmatrix::prefetch(unsigned int row, unsigned int col0, unsigned int col1) {
+	if (fd < 0 || col1 <= col0) return;
+	unsigned long page = sysconf(_SC_PAGESIZE);
+	unsigned long start = ((unsigned long)row) * (n_cols/8) + col0/8;
+	unsigned long stop = min(n_bytes, ((unsigned long)row) * (n_cols/8) + (col1+7)/8);
+	madvise(bytes + (start & ~(page - 1)), stop - (start & ~(page - 1)), MADV_WILLNEED);
+}
+
 #endif
@@ -27,26 +27,80 @@ genotype_set::genotype_set() {
 }
 
 genotype_set::~genotype_set() {
-	for (int i = 0 ; i< vecG.size() ; i ++) delete vecG[i];
 	vecG.clear();
+	vector < genotype > ().swap(arenaGenotypes);
+	huge_vector < unsigned char > ().swap(arenaVariants);
+	huge_vector < unsigned char > ().swap(arenaAmbiguous);
+	huge_vector < unsigned long > ().swap(arenaDiplotypes);
+	huge_vector < unsigned short > ().swap(arenaLengths);
+	vector < unsigned long > ().swap(offsetAmbiguous);
+	vector < unsigned long > ().swap(offsetSegments);
 	n_site = 0;
 	n_ind = 0;
 }
 
-void genotype_set::imputeMonomorphic(variant_map & V) {
+void genotype_set::allocate(int _n_ind, int _n_site) {
+	n_ind = _n_ind;
+	n_site = _n_site;
+	unsigned long stride = DIV2(n_site) + MOD2(n_site);
+	arenaVariants = huge_vector < unsigned char > (stride * n_ind, 0);
+	arenaGenotypes.clear();
+	arenaGenotypes.reserve(n_ind);
+	vecG = vector < genotype * > (n_ind);
+	for (int i = 0 ; i < n_ind ; i ++) {
+		arenaGenotypes.emplace_back(i);
+		vecG[i] = &arenaGenotypes[i];
+		vecG[i]->n_variants = n_site;
+		vecG[i]->Variants = arenaVariants.data() + stride * i;
+	}
+}
+
+void genotype_set::allocateGraphs() {
+	offsetAmbiguous = vector < unsigned long > (n_ind + 1, 0);
+	offsetSegments = vector < unsigned long > (n_ind + 1, 0);
+	for (int i = 0 ; i < n_ind ; i ++) {
+		offsetAmbiguous[i+1] = offsetAmbiguous[i] + vecG[i]->n_ambiguous;
+		offsetSegments[i+1] = offsetSegments[i] + vecG[i]->n_segments;
+	}
+	arenaAmbiguous = huge_vector < unsigned char > (offsetAmbiguous.back(), 0);
+	arenaDiplotypes = huge_vector < unsigned long > (offsetSegments.back(), 0);
+	arenaLengths = huge_vector < unsigned short > (offsetSegments.back(), 0);
+	for (int i = 0 ; i < n_ind ; i ++) {
+		vecG[i]->Ambiguous = arenaAmbiguous.data() + offsetAmbiguous[i];
+		vecG[i]->Diplotypes = arenaDiplotypes.data() + offsetSegments[i];
+		vecG[i]->Lengths = arenaLengths.data() + offsetSegments[i];
+	}
+}
+
+void genotype_set::compact() {
+	vector < unsigned long > offsetSegments2 = vector < unsigned long > (n_ind + 1, 0);
+	for (int i = 0 ; i < n_ind ; i ++) offsetSegments2[i+1] = offsetSegments2[i] + vecG[i]->n_segments;
+	huge_vector < unsigned long > arenaDiplotypes2 = huge_vector < unsigned long > (offsetSegments2.back(), 0);
+	huge_vector < unsigned short > arenaLengths2 = huge_vector < unsigned short > (offsetSegments2.back(), 0);
+	for (int i = 0 ; i < n_ind ; i ++) {
+		std::copy(vecG[i]->Diplotypes, vecG[i]->Diplotypes + vecG[i]->n_segments, arenaDiplotypes2.begin() + offsetSegments2[i]);
+		std::copy(vecG[i]->Lengths, vecG[i]->Lengths + vecG[i]->n_segments, arenaLengths2.begin() + offsetSegments2[i]);
+		vecG[i]->Diplotypes = arenaDiplotypes2.data() + offsetSegments2[i];
+		vecG[i]->Lengths = arenaLengths2.data() + offsetSegments2[i];
+	}
+	arenaDiplotypes.swap(arenaDiplotypes2);
+	arenaLengths.swap(arenaLengths2);
+	offsetSegments.swap(offsetSegments2);
+}
+
+void genotype_set::imputeMonomorphic(variant_map & V, int n_thread) {
+	mono_variants.clear();
 	for (unsigned int v = 0 ; v < V.size() ; v ++) {
 		if (V.vec_pos[v]->isMonomorphic()) {
 			bool uallele = (V.vec_pos[v]->cref)?false:true;
-			for (unsigned int i = 0 ; i < vecG.size() ; i ++) {
-				VAR_SET_HOM(MOD2(v), vecG[i]->Variants[DIV2(v)]);
-				uallele?VAR_SET_HAP0(MOD2(v), vecG[i]->Variants[DIV2(v)]):VAR_CLR_HAP0(MOD2(v), vecG[i]->Variants[DIV2(v)]);
-				uallele?VAR_SET_HAP1(MOD2(v), vecG[i]->Variants[DIV2(v)]):VAR_CLR_HAP1(MOD2(v), vecG[i]->Variants[DIV2(v)]);
-			}
+			mono_variants.push_back(2 * v + uallele);
 			if (uallele) V.vec_pos[v]->cref = 0;
 			else V.vec_pos[v]->calt = 0;
 			V.vec_pos[v]->cmis = 0;
 		}
 	}
+	if (mono_variants.size()) run(GSET_IMPUTE, n_thread);
+	vector < unsigned int > ().swap(mono_variants);
 }
 
 unsigned int genotype_set::largestNumberOfTransitions() {
@@ -64,12 +118,64 @@ unsigned long genotype_set::numberOfSegments() {
 	return size;
 }
 
-void genotype_set::masking() {
-	for (int i = 0 ; i < n_ind ; i ++) vecG[i]->mask();
+void genotype_set::masking(int n_thread) {
+	run(GSET_MASK, n_thread);
 }
 
-void genotype_set::solve() {
+void genotype_set::solve(int n_thread) {
 	tac.clock();
-	for (int i = 0 ; i < vecG.size() ; i ++) vecG[i]->solve();
+	thread_maxProbs = vector < vector < double > > (n_thread);
+	thread_maxIndexes = vector < vector < int > > (n_thread);
+	thread_dipSampled = vector < vector < unsigned char > > (n_thread);
+	run(GSET_SOLVE, n_thread);
+	vector < vector < double > > ().swap(thread_maxProbs);
+	vector < vector < int > > ().swap(thread_maxIndexes);
+	vector < vector < unsigned char > > ().swap(thread_dipSampled);
 	vrb.bullet("HAP solving (" + stb.str(tac.rel_time()*1.0/1000, 2) + "s)");
 }
+
+void * genotype_set_callback(void * ptr) {
+	genotype_set * G = static_cast< genotype_set * >( ptr );
+	int id_worker, id_job;
+	pthread_mutex_lock(&G->mutex_workers);
+	id_worker = G->i_workers ++;
+	pthread_mutex_unlock(&G->mutex_workers);
+	for(;;) {
+		pthread_mutex_lock(&G->mutex_workers);
+		id_job = G->i_jobs ++;
+		pthread_mutex_unlock(&G->mutex_workers);
+		if (id_job < G->vecG.size()) G->run(G->i_task, id_worker, id_job);
+		else pthread_exit(NULL);
+	}
+	return NULL;
+}
+
+void genotype_set::run(int task, int n_thread) {
+	i_task = task;
+	if (n_thread > 1) {
+		i_workers = 0; i_jobs = 0;
+		id_workers = vector < pthread_t > (n_thread);
+		pthread_mutex_init(&mutex_workers, NULL);
+		for (int t = 0 ; t < n_thread ; t++) pthread_create( &id_workers[t] , NULL, genotype_set_callback, static_cast<void *>(this));
+		for (int t = 0 ; t < n_thread ; t++) pthread_join( id_workers[t] , NULL);
+		pthread_mutex_destroy(&mutex_workers);
+		id_workers.clear();
+	} else for (int i = 0 ; i < vecG.size() ; i ++) run(task, 0, i);
+}
+
+void genotype_set::run(int task, int id_worker, int ind) {
+	switch (task) {
+	case GSET_IMPUTE:	for (unsigned int m = 0 ; m < mono_variants.size() ; m ++) {
+							unsigned int v = mono_variants[m] / 2;
+							bool uallele = mono_variants[m] % 2;
+							VAR_SET_HOM(MOD2(v), vecG[ind]->Variants[DIV2(v)]);
+							uallele?VAR_SET_HAP0(MOD2(v), vecG[ind]->Variants[DIV2(v)]):VAR_CLR_HAP0(MOD2(v), vecG[ind]->Variants[DIV2(v)]);
+							uallele?VAR_SET_HAP1(MOD2(v), vecG[ind]->Variants[DIV2(v)]):VAR_CLR_HAP1(MOD2(v), vecG[ind]->Variants[DIV2(v)]);
+						}
+						break;
+	case GSET_MASK:		vecG[ind]->mask();
+						break;
+	case GSET_SOLVE:	vecG[ind]->solve(thread_maxProbs[id_worker], thread_maxIndexes[id_worker], thread_dipSampled[id_worker]);
+						break;
+	}
+}
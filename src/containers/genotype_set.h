@@ -24,25 +24,54 @@
 
 #include <utils/otools.h>
 
+#include <utils/huge_pages.h>
+
 #include <objects/genotype/genotype_header.h>
 #include <containers/variant_map.h>
 
+#define GSET_IMPUTE	0
+#define GSET_MASK	1
+#define GSET_SOLVE	2
+
 class genotype_set {
 public:
 	//DATA
 	int n_site, n_ind;					//Number of variants, number of individuals
 	vector < genotype * > vecG;			//Vector of genotype graphs
 
+	//ARENAS (all genotype graphs, one contiguous block per array)
+	vector < genotype > arenaGenotypes;				//Genotype objects, pointed to by vecG
+	huge_vector < unsigned char > arenaVariants;		//Variants, fixed stride per individual
+	huge_vector < unsigned char > arenaAmbiguous;		//Ambiguous, sliced by offsetAmbiguous
+	huge_vector < unsigned long > arenaDiplotypes;		//Diplotypes, sliced by offsetSegments
+	huge_vector < unsigned short > arenaLengths;		//Lengths, sliced by offsetSegments
+	vector < unsigned long > offsetAmbiguous;		//Start of each individual in arenaAmbiguous (n_ind+1)
+	vector < unsigned long > offsetSegments;		//Start of each individual in arenaDiplotypes/arenaLengths (n_ind+1)
+
+	//MULTI-THREADING
+	int i_workers, i_jobs, i_task;
+	pthread_mutex_t mutex_workers;
+	vector < pthread_t > id_workers;
+	vector < vector < double > > thread_maxProbs;			//Flat Viterbi buffers, one per thread
+	vector < vector < int > > thread_maxIndexes;
+	vector < vector < unsigned char > > thread_dipSampled;
+	vector < unsigned int > mono_variants;					//Monomorphic variants to be imputed, with the allele in the lowest bit
+
 	//CONSTRUCTOR/DESTRUCTOR
 	genotype_set();
 	~genotype_set();
 
 	//METHODS
-	void imputeMonomorphic(variant_map &);		//Impute to REF monomorphic variants
+	void allocate(int, int);					//Allocate genotype objects and their Variants
+	void allocateGraphs();						//Allocate Ambiguous/Diplotypes/Lengths from the sizes given by genotype::count
+	void compact();								//Repack Diplotypes/Lengths after pruning shrunk the genotype graphs
+	void imputeMonomorphic(variant_map &, int n_thread = 1);	//Impute to REF monomorphic variants
 	unsigned int largestNumberOfTransitions();	//Get the number of transitions in the larger genotype graph. Used to initialize memory space for multi-threading.
 	unsigned long numberOfSegments();			//Total number of segments across all genotype graphs (used for verbose).
-	void masking();								//Call function mask for all genotype graphs
-	void solve();								//Call function solve for all genotype graphs
+	void masking(int n_thread = 1);				//Call function mask for all genotype graphs
+	void solve(int n_thread = 1);				//Call function solve for all genotype graphs
+	void run(int, int);							//Run a task over all genotype graphs using n_thread threads
+	void run(int, int, int);					//Run a task on a given genotype graph from a given thread
 };
 
 #endif
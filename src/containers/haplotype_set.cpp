@@ -41,9 +41,12 @@ void haplotype_set::clear() {
 	nthreads = 0;
 	pbwt_evaluated.clear();
 	pbwt_stored.clear();
-	pbwt_parray.clear();
-	pbwt_darray.clear();
+	pbwt_arrays.free();
 	pbwt_neighbours.clear();
+	pbwt_lastneighbours.clear();
+	pbwt_refpositions.clear();
+	pbwt_reference.clear();
+	H_opt_hap_numa.clear();
 }
 
 void haplotype_set::parametrizePBWT(int _pbwt_depth, double _pbwt_modulo, int _pbwt_mac, double _pbwt_mdr, int _nthreads) {
@@ -86,9 +89,9 @@ void haplotype_set::updatePBWTmapping() {
 
 void haplotype_set::allocatePBWTarrays() {
 	assert(pbwt_evaluated.size() > 0);
-	pbwt_neighbours = vector < int > ((pbwt_depth+1) * pbwt_nstored * n_ind * 2UL, 0);	//The depth+1 is there for transposing the matrix
-	pbwt_parray = vector < int > (n_hap, 0);
-	pbwt_darray = vector < int > (n_hap, 0);
+	pbwt_neighbours = vector < huge_vector < PBWTrun > > (n_ind * 2UL);
+	pbwt_lastneighbours = vector < int > (pbwt_depth * n_ind * 2UL, -1);
+	pbwt_arrays.allocate(n_hap);
 }
 
 void haplotype_set::updateHaplotypes(genotype_set & G, bool first_time) {
@@ -120,89 +123,75 @@ void haplotype_set::transposeHaplotypes_V2H(bool full) {
 	vrb.bullet("V2H transpose (" + stb.str(tac.rel_time()*1.0/1000, 2) + "s)");
 }
 
-void haplotype_set::transposePBWTarrays() {
+void haplotype_set::replicateHaplotypes(numa_policy & numa) {
 	tac.clock();
-	int block = 32;
-	unsigned long addr_tar, addr_src;
-	unsigned long addr_offset = pbwt_nstored * n_ind * 2UL;
-	for (int d = 0; d < pbwt_depth ; d ++) {
-		for (int s = 0; s < pbwt_nstored ; s += block) {
-			for(int h = 0; h < n_ind * 2; ++h) {
-				for(int b = 0; b < block && s + b < pbwt_nstored; ++b) {
-					addr_tar = pbwt_depth * addr_offset + h*pbwt_nstored + s + b;
-					addr_src = d * addr_offset + (s + b)*n_ind*2UL + h;
-					pbwt_neighbours[addr_tar] = pbwt_neighbours[addr_src];
-				}
-			}
+	bool first_time = H_opt_hap_numa.empty();
+	if (first_time) {
+		H_opt_hap_numa = vector < bitmatrix > (numa.n_nodes());
+		for (int n = 0 ; n < H_opt_hap_numa.size() ; n ++) {
+			H_opt_hap_numa[n].allocate(n_hap, n_site);
+			numa.bind(H_opt_hap_numa[n].bytes, H_opt_hap_numa[n].n_bytes, n);
 		}
-		std::copy(pbwt_neighbours.begin() + pbwt_depth * addr_offset , pbwt_neighbours.end(), pbwt_neighbours.begin() + d * addr_offset );
 	}
-	vrb.bullet("C2H transpose (" + stb.str(tac.rel_time()*1.0/1000, 2) + "s)");
+	//Only rows of the main haplotypes change between iterations, reference rows are copied once
+	unsigned long n_rows = first_time?H_opt_hap.n_rows:min(H_opt_hap.n_rows, 2*n_ind + ((2*n_ind)%8?(8-(2*n_ind)%8):0));
+	for (int n = 0 ; n < H_opt_hap_numa.size() ; n ++) memcpy(H_opt_hap_numa[n].bytes, H_opt_hap.bytes, n_rows * (H_opt_hap.n_cols/8));
+	vrb.bullet("NUMA replicas [n=" + stb.str(H_opt_hap_numa.size()) + "] (" + stb.str(tac.rel_time()*1.0/1000, 2) + "s)");
+}
+
+void haplotype_set::buildReferencePBWT() {
+	assert(n_hap > 2 * n_ind);
+	pbwt_reference.build(H_opt_var, pbwt_evaluated, pbwt_grp, n_site, 2 * n_ind, n_hap - 2 * n_ind);
+	pbwt_arrays.allocate(2 * n_ind);
+	pbwt_refpositions = vector < unsigned int > (2 * n_ind, 0);
 }
 
 void haplotype_set::selectPBWTarrays() {
+	if (pbwt_reference.n_ref) return selectPBWTarraysReference();
 	tac.clock();
-	vector < int > B = vector < int > (n_hap, 0);
-	vector < int > D = vector < int > (n_hap, 0);
+	vector < unsigned char > K = vector < unsigned char > (n_hap, 0);
+	for (int h = 0 ; h < pbwt_neighbours.size() ; h ++) pbwt_neighbours[h].clear();
+	std::fill(pbwt_lastneighbours.begin(), pbwt_lastneighbours.end(), -1);
+	pbwt_arrays.reset();
 	for (int l = 0 ; l < pbwt_evaluated.size() ; l ++) {
-		int u = 0, v = 0, p = l, q = l;
-
 		//PBWT PASS
-		for (int h = 0 ; h < n_hap ; h ++) {
-			int alookup = l?pbwt_parray[h]:h;
-			int dlookup = l?pbwt_darray[h]:0;
-			if (dlookup > p) p = dlookup;
-			if (dlookup > q) q = dlookup;
-			if (!H_opt_var.get(pbwt_evaluated[l], alookup)) {
-				pbwt_parray[u] = alookup;
-				pbwt_darray[u] = p;
-				p = 0;
-				u++;
-			} else {
-				B[v] = alookup;
-				D[v] = q;
-				q = 0;
-				v++;
-			}
-		}
-		std::copy(B.begin(), B.begin()+v, pbwt_parray.begin()+u);
-		std::copy(D.begin(), D.begin()+v, pbwt_darray.begin()+u);
+		if (l % BITMATRIX_PREFETCH_ROWS == 0) H_opt_var.prefetch(pbwt_evaluated[l], pbwt_evaluated[min((int)pbwt_evaluated.size(), l + 2 * BITMATRIX_PREFETCH_ROWS) - 1] + 1);
+		H_opt_var.unpack(pbwt_evaluated[l], n_hap, K.data());
+		pbwt_arrays.update < 2 > (K.data(), l);
 
 		//PBWT STORAGE
 		if (pbwt_stored[l] >= 0) {
-			unsigned long addr_offset = pbwt_nstored * n_ind * 2UL;
 			for (int h = 0 ; h < n_hap ; h ++) {
-				int chap = pbwt_parray[h];
+				int chap = pbwt_arrays.A[h];
 				int cind = chap / 2;
 				if (cind < n_ind) {
 					int add_guess0 = 0, add_guess1 = 0, offset0 = 1, offset1 = 1, hap_guess0 = -1, hap_guess1 = -1, div_guess0 = -1, div_guess1 = -1;
-					unsigned long tar_idx = pbwt_stored[l] * 2UL * n_ind + chap;
 					for (int n_added = 0 ; n_added < pbwt_depth ; ) {
 						if ((h-offset0)>=0) {
-							hap_guess0 = pbwt_parray[h-offset0];
-							div_guess0 = max(pbwt_darray[h-offset0+1], div_guess0);
+							hap_guess0 = pbwt_arrays.A[h-offset0];
+							div_guess0 = max(pbwt_arrays.D[h-offset0+1], div_guess0);
 							add_guess0 = checkIBD2matching(chap, hap_guess0, pbwt_cm[l]);
 							//cout << "AG0= " << hap_guess0 << " " << div_guess0 << " " << add_guess0 << endl;
 						} else { add_guess0 = 0; div_guess0 = l+1; }
 						if ((h+offset1)<n_hap) {
-							hap_guess1 = pbwt_parray[h+offset1];
-							div_guess1 = max(pbwt_darray[h+offset1], div_guess1);
+							hap_guess1 = pbwt_arrays.A[h+offset1];
+							div_guess1 = max(pbwt_arrays.D[h+offset1], div_guess1);
 							add_guess1 = checkIBD2matching(chap, hap_guess1, pbwt_cm[l]);
 							//cout << "AG1= " << hap_guess0 << " " << div_guess0 << " " << add_guess0 << endl;
 						} else { add_guess1 = 0; div_guess1 = l+1; }
 						if (add_guess0 && add_guess1) {
 							if (div_guess0 < div_guess1) {
-								pbwt_neighbours[n_added*addr_offset+tar_idx] = hap_guess0;
+								storePBWTneighbour(chap, pbwt_stored[l], n_added, hap_guess0);
 								offset0++; n_added++;
 							} else {
-								pbwt_neighbours[n_added*addr_offset+tar_idx] = hap_guess1;
+								storePBWTneighbour(chap, pbwt_stored[l], n_added, hap_guess1);
 								offset1++; n_added++;
 							}
 						} else if (add_guess0) {
-							pbwt_neighbours[n_added*addr_offset+tar_idx] = hap_guess0;
+							storePBWTneighbour(chap, pbwt_stored[l], n_added, hap_guess0);
 							offset0++; n_added++;
 						} else if (add_guess1) {
-							pbwt_neighbours[n_added*addr_offset+tar_idx] = hap_guess1;
+							storePBWTneighbour(chap, pbwt_stored[l], n_added, hap_guess1);
 							offset1++; n_added++;
 						} else {
 							offset0++;
@@ -218,6 +207,84 @@ void haplotype_set::selectPBWTarrays() {
 }
 
 
+void haplotype_set::selectPBWTarraysReference() {
+	tac.clock();
+	int n_main = 2 * n_ind;
+	vector < unsigned char > K = vector < unsigned char > (n_main, 0);
+	for (int h = 0 ; h < pbwt_neighbours.size() ; h ++) pbwt_neighbours[h].clear();
+	std::fill(pbwt_lastneighbours.begin(), pbwt_lastneighbours.end(), -1);
+	std::fill(pbwt_refpositions.begin(), pbwt_refpositions.end(), 0);
+	pbwt_arrays.reset();
+	for (int l = 0 ; l < pbwt_evaluated.size() ; l ++) {
+		//PBWT PASS: main haplotypes are sorted among themselves and positioned among references by LF-mapping
+		if (l % BITMATRIX_PREFETCH_ROWS == 0) H_opt_var.prefetch(pbwt_evaluated[l], pbwt_evaluated[min((int)pbwt_evaluated.size(), l + 2 * BITMATRIX_PREFETCH_ROWS) - 1] + 1);
+		H_opt_var.unpack(pbwt_evaluated[l], n_main, K.data());
+		for (int h = 0 ; h < n_main ; h ++) pbwt_refpositions[h] = pbwt_reference.lf(l, pbwt_refpositions[h], K[h]);
+		pbwt_arrays.update < 2 > (K.data(), l);
+
+		//PBWT STORAGE: walk the merged order, main haplotypes at position p come right before reference p
+		if (pbwt_stored[l] >= 0) {
+			const vector < int > & A = pbwt_arrays.A;
+			const vector < int > & D = pbwt_arrays.D;
+			for (int h = 0 ; h < n_main ; h ++) {
+				int chap = A[h];
+				int pos = pbwt_refpositions[chap];
+				int hu = h - 1, pu = pos - 1, hd = h + 1, pd = pos;
+				int add_guess0 = 0, add_guess1 = 0, hap_guess0 = -1, hap_guess1 = -1, div_guess0 = -1, div_guess1 = -1;
+				int div_main0 = -1, div_main1 = -1;
+				bool main_guess0 = false, main_guess1 = false, next_guess0 = true, next_guess1 = true;
+				for (int n_added = 0 ; n_added < pbwt_depth ; ) {
+					if (next_guess0) {
+						if (hu >= 0 && (int)pbwt_refpositions[A[hu]] > pu) { hap_guess0 = A[hu]; main_guess0 = true; }
+						else if (pu >= 0) { hap_guess0 = n_main + pbwt_reference.locate(l, pu); main_guess0 = false; }
+						else hap_guess0 = -1;
+						if (hap_guess0 >= 0) {
+							if (main_guess0) div_guess0 = div_main0 = max(div_main0, D[hu+1]);
+							else div_guess0 = pbwt_reference.divergence(H_opt_hap, chap, hap_guess0, pbwt_evaluated[l]);
+							add_guess0 = checkIBD2matching(chap, hap_guess0, pbwt_cm[l]);
+						} else { add_guess0 = 0; div_guess0 = l+1; }
+						next_guess0 = false;
+					}
+					if (next_guess1) {
+						if (hd < n_main && pbwt_refpositions[A[hd]] <= pd) { hap_guess1 = A[hd]; main_guess1 = true; }
+						else if (pd < pbwt_reference.n_ref) { hap_guess1 = n_main + pbwt_reference.locate(l, pd); main_guess1 = false; }
+						else hap_guess1 = -1;
+						if (hap_guess1 >= 0) {
+							if (main_guess1) div_guess1 = div_main1 = max(div_main1, D[hd]);
+							else div_guess1 = pbwt_reference.divergence(H_opt_hap, chap, hap_guess1, pbwt_evaluated[l]);
+							add_guess1 = checkIBD2matching(chap, hap_guess1, pbwt_cm[l]);
+						} else { add_guess1 = 0; div_guess1 = l+1; }
+						next_guess1 = false;
+					}
+					if (add_guess0 && add_guess1) {
+						if (div_guess0 < div_guess1) {
+							storePBWTneighbour(chap, pbwt_stored[l], n_added, hap_guess0);
+							next_guess0 = true; n_added++;
+						} else {
+							storePBWTneighbour(chap, pbwt_stored[l], n_added, hap_guess1);
+							next_guess1 = true; n_added++;
+						}
+					} else if (add_guess0) {
+						storePBWTneighbour(chap, pbwt_stored[l], n_added, hap_guess0);
+						next_guess0 = true; n_added++;
+					} else if (add_guess1) {
+						storePBWTneighbour(chap, pbwt_stored[l], n_added, hap_guess1);
+						next_guess1 = true; n_added++;
+					} else {
+						next_guess0 = true;
+						next_guess1 = true;
+					}
+					if (next_guess0 && hap_guess0 >= 0) { if (main_guess0) hu--; else pu--; }
+					if (next_guess1 && hap_guess1 >= 0) { if (main_guess1) hd++; else pd++; }
+				}
+			}
+		}
+		vrb.progress("  * PBWT selection", (l+1)*1.0/pbwt_evaluated.size());
+	}
+	vrb.bullet("PBWT selection (" + stb.str(tac.rel_time()*1.0/1000, 2) + "s)");
+}
+
+
 void haplotype_set::searchIBD2matching(variant_map & V, double minLengthIBDtrack, double windowSize, double ibd2_maf, double ibd2_mdr, int ibd2_count) {
 	assert(pbwt_evaluated.size() > 0);
 	tac.clock();
@@ -233,42 +300,36 @@ void haplotype_set::searchIBD2matching(variant_map & V, double minLengthIBDtrack
 	}
 
 	//
-	int M = 3;
-	vector < int > U = vector < int > (M, 0);
-	vector < int > P = vector < int > (M, 0);
+	vector < unsigned char > Hrow = vector < unsigned char > (2 * n_ind, 0);
+	vector < unsigned char > Gcurr = vector < unsigned char > (n_ind, 0), Gnext = vector < unsigned char > (n_ind, 0);
 	vector < int > G = vector < int > (n_ind, 0);
-	vector < vector < int > > A = vector < vector < int > > (M, vector < int > (n_ind, 0));
-	vector < vector < int > > D = vector < vector < int > > (M, vector < int > (n_ind, 0));
+	pbwt_kernel P;
+	P.allocate(n_ind, 3);
 	bannedPairs = vector < vector < IBD2track > > (n_ind);
 
+	if (ibd2_evaluated.size()) {
+		H_opt_var.unpack(ibd2_evaluated[0], 2 * n_ind, Hrow.data());
+		for (int i = 0 ; i < n_ind ; i ++) Gnext[i] = Hrow[2*i+0] + Hrow[2*i+1];
+	}
 	for (int l = 0 ; l < ibd2_evaluated.size() ; l ++) {
-		fill(U.begin(), U.end(), 0);
-		fill(P.begin(), P.end(), l);
-		for (int i = 0 ; i < n_ind ; i ++) {
-			int alookup = l?A[0][i]:i;
-			int dlookup = l?D[0][i]:0;
-			for (int g = 0 ; g < M ; g++) if (dlookup > P[g]) P[g] = dlookup;
-			G[i] = H_opt_var.get(ibd2_evaluated[l], 2*alookup+0) + H_opt_var.get(ibd2_evaluated[l], 2*alookup+1);
-			A[G[i]][U[G[i]]] = alookup;
-			D[G[i]][U[G[i]]] = P[G[i]];
-			P[G[i]] = 0;
-			U[G[i]]++;
-		}
-		for (int g = 1, offset = U[0] ; g < M ; g++) {
-			copy(A[g].begin(), A[g].begin()+U[g], A[0].begin() + offset);
-			copy(D[g].begin(), D[g].begin()+U[g], D[0].begin() + offset);
-			offset += U[g];
+		bool has_next = (l<(ibd2_evaluated.size()-1));
+		Gcurr.swap(Gnext);
+		if (has_next) {
+			H_opt_var.unpack(ibd2_evaluated[l+1], 2 * n_ind, Hrow.data());
+			for (int i = 0 ; i < n_ind ; i ++) Gnext[i] = Hrow[2*i+0] + Hrow[2*i+1];
 		}
+		for (int i = 0 ; i < n_ind ; i ++) G[i] = Gcurr[P.A[i]];
+		P.update < 3 > (Gcurr.data(), l);
 		for (int i = 1 ; i < n_ind ; i ++) {
-			int ind0 = A[0][i];
-			int ng0 = (l<(ibd2_evaluated.size()-1))?(H_opt_var.get(ibd2_evaluated[l+1], 2*ind0+0)+H_opt_var.get(ibd2_evaluated[l+1], 2*ind0+1)):-1;
+			int ind0 = P.A[i];
+			int ng0 = has_next?Gnext[ind0]:-1;
 			for (int ip = i-1, div = -1 ; ip >= 0 ; ip --) {
 				if (G[ip] != G[i]) break;
-				div = max(div, D[0][ip+1]);
+				div = max(div, P.D[ip+1]);
 				double lengthMatchCM = ibd2_cm[l] - ibd2_cm[div];
 				if (lengthMatchCM >= minLengthIBDtrack && l-div >= ibd2_count) {
-					int ind1 = A[0][ip];
-					int ng1 = (l<(ibd2_evaluated.size()-1))?(H_opt_var.get(ibd2_evaluated[l+1], 2*ind1+0)+H_opt_var.get(ibd2_evaluated[l+1], 2*ind1+1)):-1;
+					int ind1 = P.A[ip];
+					int ng1 = has_next?Gnext[ind1]:-1;
 					if (ng0 < 0 || ng0 != ng1) {
 						bannedPairs[min(ind0, ind1)].push_back(IBD2track(max(ind0, ind1), ((ibd2_cm[div]-windowSize)>=0)?(ibd2_cm[div]-windowSize):0.0f, ibd2_cm[l] + windowSize));
 					}
@@ -27,6 +27,9 @@
 #include <containers/bitmatrix.h>
 #include <containers/genotype_set.h>
 #include <containers/variant_map.h>
+#include <containers/reference_pbwt.h>
+#include <models/pbwt_kernel.h>
+#include <utils/numa_policy.h>
 
 struct IBD2track {
 	int ind;
@@ -49,11 +52,22 @@ struct IBD2track {
 	}
 } ;
 
+struct PBWTrun {
+	unsigned int idx;	// Stored index * pbwt_depth + rank of the neighbour
+	int hap;			// Neighbour, valid until the next run with the same rank
+
+	PBWTrun(unsigned int _idx, int _hap) {
+		idx = _idx;
+		hap = _hap;
+	}
+} ;
+
 class haplotype_set {
 public:
 	//Haplotype Data
 	bitmatrix H_opt_hap;		// Bit matrix of haplotypes (haplotype first). Transposed version of H_opt_var.
 	bitmatrix H_opt_var;		// Bit matrix of haplotypes (variant first). Transposed version of H_opt_hap.
+	vector < bitmatrix > H_opt_hap_numa;	// Copies of H_opt_hap, one per NUMA node (--numa replicate)
 	unsigned long n_site;		// #variants
 	unsigned long n_hap;		// #haplotypes
 	unsigned long n_ind;		// #individuals
@@ -71,9 +85,11 @@ public:
 	vector < int > pbwt_grp;		//Variant groups based on cm positions
 	vector < int > pbwt_evaluated;	//Variants at which PBWT is evaluated
 	vector < int > pbwt_stored;		//Variants at which PBWT is stored
-	vector < int > pbwt_parray;		//PBWT prefix array
-	vector < int > pbwt_darray;		//PBWT divergence array
-	vector < int > pbwt_neighbours; //Closest neighbours
+	pbwt_kernel pbwt_arrays;		//PBWT prefix and divergence arrays
+	vector < huge_vector < PBWTrun > > pbwt_neighbours;	//Closest neighbours, run-length encoded per haplotype (haplotype first)
+	vector < int > pbwt_lastneighbours;				//Last neighbour stored for each haplotype and rank
+	vector < unsigned int > pbwt_refpositions;		//Position of each main haplotype among the reference haplotypes
+	reference_pbwt pbwt_reference;					//Static PBWT of the reference haplotypes
 
 	//PBWT IBD2 protect
 	vector < vector < IBD2track > > bannedPairs;
@@ -88,8 +104,10 @@ public:
 	void initializePBWTmapping(variant_map &);
 	void updatePBWTmapping();
 	void allocatePBWTarrays();
+	void buildReferencePBWT();
 	void selectPBWTarrays();
-	void transposePBWTarrays();
+	void selectPBWTarraysReference();
+	void storePBWTneighbour(int, int, int, int);
 
 	//IBD2 routines
 	void searchIBD2matching(variant_map & V, double minLengthIBDtrack, double windowSize, double ibd2_maf, double ibd2_mdr, int ibd2_count);
@@ -100,8 +118,18 @@ public:
 	void updateHaplotypes(genotype_set & G, bool first_time = false);
 	void transposeHaplotypes_H2V(bool full);
 	void transposeHaplotypes_V2H(bool full);
+	void replicateHaplotypes(numa_policy &);
 };
 
+inline
+void haplotype_set::storePBWTneighbour(int hap, int idx, int rank, int neighbour) {
+	int & last = pbwt_lastneighbours[hap * pbwt_depth + rank];
+	if (last != neighbour) {
+		pbwt_neighbours[hap].push_back(PBWTrun(idx * pbwt_depth + rank, neighbour));
+		last = neighbour;
+	}
+}
+
 inline
 bool haplotype_set::checkIBD2matching(int mh, int ch, double pos) {
 	int mi = min(mh/2,ch/2);
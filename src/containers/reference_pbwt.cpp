@@ -0,0 +1,83 @@
+/*******************************************************************************
+ * Copyright (C) 2018 Olivier Delaneau, University of Lausanne
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#include <containers/reference_pbwt.h>
+#include <models/pbwt_kernel.h>
+
+reference_pbwt::reference_pbwt() {
+	clear();
+}
+
+reference_pbwt::~reference_pbwt() {
+	clear();
+}
+
+void reference_pbwt::clear() {
+	n_ref = 0;
+	n_words = 0;
+	vector < uint64_t > ().swap(bits);
+	vector < unsigned int > ().swap(ranks);
+	vector < int > ().swap(sample_site);
+	vector < int > ().swap(sample_index);
+	vector < int > ().swap(samples);
+	vector < uint64_t > ().swap(evaluated_mask);
+	vector < int > ().swap(evaluated_index);
+}
+
+void reference_pbwt::build(bitmatrix & H_opt_var, vector < int > & pbwt_evaluated, vector < int > & pbwt_grp, unsigned int n_site, unsigned int ref_offset, unsigned int _n_ref) {
+	tac.clock();
+	n_ref = _n_ref;
+	n_words = (n_ref + 63) / 64;
+	unsigned int n_evaluated = pbwt_evaluated.size();
+	bits = vector < uint64_t > (n_evaluated * (unsigned long)n_words, 0UL);
+	ranks = vector < unsigned int > (n_evaluated * (n_words + 1UL), 0);
+	sample_site = vector < int > (n_evaluated, 0);
+	sample_index = vector < int > (n_evaluated, 0);
+	samples.clear();
+
+	evaluated_mask = vector < uint64_t > ((n_site + 63) / 64, 0UL);
+	evaluated_index = vector < int > (n_site, -1);
+	for (int l = 0 ; l < n_evaluated ; l ++) {
+		evaluated_mask[pbwt_evaluated[l] / 64] |= 1UL << (63 - (pbwt_evaluated[l] % 64));
+		evaluated_index[pbwt_evaluated[l]] = l;
+	}
+
+	pbwt_kernel P;
+	P.allocate(n_ref);
+	vector < unsigned char > K = vector < unsigned char > (ref_offset + n_ref, 0);
+	const unsigned char * key = K.data() + ref_offset;
+	for (int l = 0, n_samples = 0 ; l < n_evaluated ; l ++) {
+		H_opt_var.unpack(pbwt_evaluated[l], ref_offset + n_ref, K.data());
+		uint64_t * B = &bits[l * (unsigned long)n_words];
+		unsigned int * R = &ranks[l * (n_words + 1UL)];
+		for (unsigned int e = 0 ; e < n_ref ; e ++) B[e / 64] |= ((uint64_t)key[P.A[e]]) << (e % 64);
+		for (unsigned int w = 0 ; w < n_words ; w ++) R[w + 1] = R[w] + __builtin_popcountll(B[w]);
+		P.update < 2 > (key, l);
+		if (l == 0 || pbwt_grp[l] != pbwt_grp[l-1] || (l - sample_site[l-1]) >= REFERENCE_PBWT_SAMPLING) {
+			samples.insert(samples.end(), P.A.begin(), P.A.end());
+			sample_site[l] = l;
+			n_samples ++;
+		} else sample_site[l] = sample_site[l-1];
+		sample_index[l] = n_samples - 1;
+		vrb.progress("  * Reference PBWT", (l+1)*1.0/n_evaluated);
+	}
+	vrb.bullet("Reference PBWT [#haps=" + stb.str(n_ref) + " / #samples=" + stb.str(samples.size() / n_ref) + "] (" + stb.str(tac.rel_time()*1.0/1000, 2) + "s)");
+}
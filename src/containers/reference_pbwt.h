@@ -0,0 +1,117 @@
+/*******************************************************************************
+ * Copyright (C) 2018 Olivier Delaneau, University of Lausanne
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#ifndef _REFERENCE_PBWT_H
+#define _REFERENCE_PBWT_H
+
+#include <utils/otools.h>
+#include <containers/bitmatrix.h>
+
+#define REFERENCE_PBWT_SAMPLING 32
+
+/*
+ * PBWT of the reference haplotypes only, computed once since they never change across iterations.
+ * Each evaluated column is stored as bits in the reference order preceding it, with rank checkpoints
+ * every 64 bits, so that the position of any target haplotype among the references can be updated
+ * by LF-mapping. Prefix arrays are sampled at the first variant of each PBWT group (and at least
+ * every REFERENCE_PBWT_SAMPLING variants) and other positions are resolved by walking back with select.
+ */
+class reference_pbwt {
+public:
+	unsigned int n_ref;						// #reference haplotypes
+	unsigned int n_words;					// #64 bits words per column
+	vector < uint64_t > bits;				// Columns in the order preceding them (bit e of word e/64 is position e)
+	vector < unsigned int > ranks;			// #ones before each word of each column (n_words+1 per column)
+	vector < int > sample_site;				// For each evaluated variant, the variant at which the prefix array is sampled
+	vector < int > sample_index;			// For each evaluated variant, the index of the sampled prefix array
+	vector < int > samples;					// Sampled prefix arrays
+	vector < uint64_t > evaluated_mask;		// Evaluated variants as a bit mask over all variants (first variant in most significant bit)
+	vector < int > evaluated_index;			// For each variant, its index among evaluated variants (-1 otherwise)
+
+	reference_pbwt();
+	~reference_pbwt();
+	void clear();
+
+	void build(bitmatrix & H_opt_var, vector < int > & pbwt_evaluated, vector < int > & pbwt_grp, unsigned int n_site, unsigned int ref_offset, unsigned int _n_ref);
+
+	unsigned int rank(int l, unsigned int p);
+	unsigned int lf(int l, unsigned int p, bool a);
+	unsigned int select(int l, bool a, unsigned int j);
+	int locate(int l, unsigned int p);
+	int divergence(bitmatrix & H_opt_hap, int h0, int h1, int site);
+};
+
+// #ones among the first p positions of column l
+inline
+unsigned int reference_pbwt::rank(int l, unsigned int p) {
+	unsigned int w = p / 64, b = p % 64;
+	unsigned int r = ranks[l * (n_words + 1UL) + w];
+	if (b) r += __builtin_popcountll(bits[l * (unsigned long)n_words + w] & ((1UL << b) - 1));
+	return r;
+}
+
+// Position among the references after column l of a haplotype at position p before it carrying allele a
+inline
+unsigned int reference_pbwt::lf(int l, unsigned int p, bool a) {
+	unsigned int r = rank(l, p);
+	if (!a) return p - r;
+	return n_ref - ranks[l * (n_words + 1UL) + n_words] + r;
+}
+
+// Position before column l of the j-th reference carrying allele a
+inline
+unsigned int reference_pbwt::select(int l, bool a, unsigned int j) {
+	const unsigned int * R = &ranks[l * (n_words + 1UL)];
+	unsigned int lo = 0, hi = n_words - 1;
+	while (lo < hi) {
+		unsigned int mid = (lo + hi + 1) / 2;
+		unsigned int cnt = a ? R[mid] : (64 * mid - R[mid]);
+		if (cnt <= j) lo = mid;
+		else hi = mid - 1;
+	}
+	uint64_t word = bits[l * (unsigned long)n_words + lo];
+	if (!a) word = ~word;
+	for (unsigned int r = j - (a ? R[lo] : (64 * lo - R[lo])) ; r > 0 ; r --) word &= word - 1;
+	return 64 * lo + __builtin_ctzll(word);
+}
+
+// Reference index at position p after column l
+inline
+int reference_pbwt::locate(int l, unsigned int p) {
+	for (int s = sample_site[l] ; l > s ; l --) {
+		unsigned int n_zeros = n_ref - ranks[l * (n_words + 1UL) + n_words];
+		p = (p < n_zeros) ? select(l, false, p) : select(l, true, p - n_zeros);
+	}
+	return samples[sample_index[l] * (unsigned long)n_ref + p];
+}
+
+// Last evaluated variant up to site at which two haplotypes differ, as given by the PBWT divergence arrays
+inline
+int reference_pbwt::divergence(bitmatrix & H_opt_hap, int h0, int h1, int site) {
+	uint64_t mask = ~0UL << (63 - (site % 64));
+	for (int w = site / 64 ; w >= 0 ; w --, mask = ~0UL) {
+		uint64_t diff = (H_opt_hap.getWord(h0, w) ^ H_opt_hap.getWord(h1, w)) & evaluated_mask[w] & mask;
+		if (diff) return evaluated_index[64 * w + 63 - __builtin_ctzll(diff)];
+	}
+	return 0;
+}
+
+#endif
@@ -0,0 +1,96 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2018 Olivier Delaneau, University of Lausanne
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+#include <io/checkpoint_reader.h>
+
+checkpoint_reader::checkpoint_reader(haplotype_set & _H, genotype_set & _G) : H(_H), G(_G) {
+	offset = 0;
+}
+
+checkpoint_reader::~checkpoint_reader() {
+	vector < char > ().swap(buffer);
+}
+
+/*
+ * Restores the state saved by checkpoint_writer into genotype graphs allocated for the same input data.
+ */
+void checkpoint_reader::readCheckpoint(string fcheckpoint, string scheme, unsigned int & next_stage, unsigned int & next_iteration) {
+	tac.clock();
+	fname = fcheckpoint;
+	ifstream fd (fname.c_str(), ios::in | ios::binary);
+	if (fd.fail()) vrb.error("Impossible to open checkpoint [" + fname + "]");
+	buffer.assign(istreambuf_iterator < char > (fd), istreambuf_iterator < char > ());
+	fd.close();
+	offset = 0;
+
+	//Header
+	string magic, ckpt_scheme, rng_state;
+	unsigned int version, n_ind, n_site;
+	unsigned long n_hap;
+	get(magic);
+	if (magic != CHECKPOINT_MAGIC) vrb.error("[" + fname + "] is not a SHAPEIT4 checkpoint");
+	get(version);
+	if (version != CHECKPOINT_VERSION) vrb.error("Unsupported checkpoint version [" + stb.str(version) + "]");
+	get(n_ind);
+	get(n_site);
+	get(n_hap);
+	if (n_ind != G.n_ind || n_site != G.n_site || n_hap != H.n_hap) vrb.error("Checkpoint [" + fname + "] was made on different data [N=" + stb.str(n_ind) + " / L=" + stb.str(n_site) + "]");
+	get(ckpt_scheme);
+	if (ckpt_scheme != scheme) vrb.error("Checkpoint [" + fname + "] was made with another iteration scheme [" + ckpt_scheme + "]");
+	get(next_stage);
+	get(next_iteration);
+	get(rng_state);
+	stringstream ss (rng_state);
+	ss >> rng.getEngine();
+
+	//Genotype graphs
+	unsigned long stride = DIV2(G.n_site) + MOD2(G.n_site);
+	for (int i = 0 ; i < G.n_ind ; i ++) {
+		genotype * g = G.vecG[i];
+		get(g->n_segments);
+		get(g->n_ambiguous);
+		get(g->n_transitions);
+		get(g->Variants, stride);
+	}
+	G.allocateGraphs();
+	for (int i = 0 ; i < G.n_ind ; i ++) {
+		genotype * g = G.vecG[i];
+		get(g->Ambiguous, g->n_ambiguous);
+		get(g->Diplotypes, g->n_segments);
+		get(g->Lengths, g->n_segments);
+		get(g->ProbMask);
+		unsigned long n_stored;
+		get(n_stored);
+		g->ProbStored = vector < float > (n_stored, 0.0f);
+		get(g->ProbStored.data(), n_stored);
+	}
+
+	//IBD2 constraints
+	unsigned long n_banned, n_pairs;
+	get(n_banned);
+	H.bannedPairs = vector < vector < IBD2track > > (n_banned);
+	for (int i = 0 ; i < n_banned ; i ++) {
+		get(n_pairs);
+		H.bannedPairs[i] = vector < IBD2track > (n_pairs, IBD2track(0, 0.0f, 0.0f));
+		get(H.bannedPairs[i].data(), n_pairs);
+	}
+	vrb.bullet("Checkpoint resumed [" + fname + " / next=" + stb.str(next_stage) + ":" + stb.str(next_iteration) + " / seg=" + stb.str(G.numberOfSegments()) + "] (" + stb.str(tac.rel_time()*1.0/1000, 2) + "s)");
+}
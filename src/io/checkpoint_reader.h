@@ -0,0 +1,87 @@
+/*******************************************************************************
+ * Copyright (C) 2018 Olivier Delaneau, University of Lausanne
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#ifndef _CHECKPOINT_READER_H
+#define _CHECKPOINT_READER_H
+
+#include <utils/otools.h>
+
+#include <io/checkpoint_writer.h>
+
+class checkpoint_reader {
+public:
+	//DATA
+	haplotype_set & H;
+	genotype_set & G;
+	string fname;
+	vector < char > buffer;
+	unsigned long offset;
+
+	//CONSTRUCTORS/DESCTRUCTORS
+	checkpoint_reader(haplotype_set &, genotype_set &);
+	~checkpoint_reader();
+
+	//IO
+	void readCheckpoint(string, string, unsigned int &, unsigned int &);
+
+	//SERIALISATION
+	template < class T > void get(T & v);
+	template < class T > void get(T * v, unsigned long n);
+	void get(vector < bool > & v);
+	void get(string & s);
+};
+
+template < class T >
+inline
+void checkpoint_reader::get(T * v, unsigned long n) {
+	if (offset + n * sizeof(T) > buffer.size()) vrb.error("Checkpoint [" + fname + "] is truncated");
+	memcpy(reinterpret_cast < char * > (v), buffer.data() + offset, n * sizeof(T));
+	offset += n * sizeof(T);
+}
+
+template < class T >
+inline
+void checkpoint_reader::get(T & v) {
+	get(&v, 1);
+}
+
+inline
+void checkpoint_reader::get(vector < bool > & v) {
+	unsigned long n;
+	get(n);
+	v = vector < bool > (n, false);
+	for (unsigned long b = 0 ; b < n ; b += 8) {
+		unsigned char byte;
+		get(byte);
+		for (unsigned long e = b ; e < min(b + 8, n) ; e ++) v[e] = (byte >> (e - b)) & 1;
+	}
+}
+
+inline
+void checkpoint_reader::get(string & s) {
+	unsigned long n;
+	get(n);
+	if (offset + n > buffer.size()) vrb.error("Checkpoint [" + fname + "] is truncated");
+	s = string(buffer.data() + offset, n);
+	offset += n;
+}
+
+#endif
@@ -0,0 +1,104 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2018 Olivier Delaneau, University of Lausanne
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+#include <io/checkpoint_writer.h>
+
+checkpoint_writer::checkpoint_writer(haplotype_set & _H, genotype_set & _G) : H(_H), G(_G) {
+	writing = false;
+}
+
+checkpoint_writer::~checkpoint_writer() {
+	wait();
+	vector < char > ().swap(buffer);
+}
+
+void * checkpoint_writer_callback(void * ptr) {
+	checkpoint_writer * C = static_cast< checkpoint_writer * >( ptr );
+	C->flush();
+	pthread_exit(NULL);
+	return NULL;
+}
+
+void checkpoint_writer::wait() {
+	if (writing) pthread_join(id_writer, NULL);
+	writing = false;
+}
+
+/*
+ * Written next to the target and renamed once complete, so that a preempted write never replaces a good checkpoint.
+ */
+void checkpoint_writer::flush() {
+	string ftmp = fname + ".tmp";
+	ofstream fd (ftmp.c_str(), ios::out | ios::binary);
+	fd.write(buffer.data(), buffer.size());
+	fd.close();
+	if (fd.fail() || rename(ftmp.c_str(), fname.c_str()) != 0) vrb.warning("Impossible to write checkpoint [" + fname + "]");
+}
+
+void checkpoint_writer::writeCheckpoint(string fcheckpoint, string scheme, unsigned int next_stage, unsigned int next_iteration) {
+	tac.clock();
+	wait();
+	fname = fcheckpoint;
+	buffer.clear();
+
+	//Header
+	put(string(CHECKPOINT_MAGIC));
+	put((unsigned int)CHECKPOINT_VERSION);
+	put((unsigned int)G.n_ind);
+	put((unsigned int)G.n_site);
+	put((unsigned long)H.n_hap);
+	put(scheme);
+	put(next_stage);
+	put(next_iteration);
+	stringstream ss;
+	ss << rng.getEngine();
+	put(ss.str());
+
+	//Genotype graphs: sizes and Variants first, so that the reader can allocate the arenas in a single pass
+	unsigned long stride = DIV2(G.n_site) + MOD2(G.n_site);
+	for (int i = 0 ; i < G.n_ind ; i ++) {
+		genotype * g = G.vecG[i];
+		put(g->n_segments);
+		put(g->n_ambiguous);
+		put(g->n_transitions);
+		put(g->Variants, stride);
+	}
+	for (int i = 0 ; i < G.n_ind ; i ++) {
+		genotype * g = G.vecG[i];
+		put(g->Ambiguous, g->n_ambiguous);
+		put(g->Diplotypes, g->n_segments);
+		put(g->Lengths, g->n_segments);
+		put(g->ProbMask);
+		put((unsigned long)g->ProbStored.size());
+		put(g->ProbStored.data(), g->ProbStored.size());
+	}
+
+	//IBD2 constraints
+	put((unsigned long)H.bannedPairs.size());
+	for (int i = 0 ; i < H.bannedPairs.size() ; i ++) {
+		put((unsigned long)H.bannedPairs[i].size());
+		put(H.bannedPairs[i].data(), H.bannedPairs[i].size());
+	}
+
+	writing = (pthread_create(&id_writer, NULL, checkpoint_writer_callback, static_cast<void *>(this)) == 0);
+	if (!writing) flush();
+	vrb.bullet("Checkpoint [" + stb.str(buffer.size() * 1.0 / (1 << 20), 1) + "MB / next=" + stb.str(next_stage) + ":" + stb.str(next_iteration) + "] (" + stb.str(tac.rel_time()*1.0/1000, 2) + "s)");
+}
@@ -0,0 +1,95 @@
+/*******************************************************************************
+ * Copyright (C) 2018 Olivier Delaneau, University of Lausanne
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#ifndef _CHECKPOINT_WRITER_H
+#define _CHECKPOINT_WRITER_H
+
+#include <utils/otools.h>
+
+#include <containers/haplotype_set.h>
+#include <containers/genotype_set.h>
+
+#define CHECKPOINT_MAGIC	"SHAPEIT4CKPT"
+#define CHECKPOINT_VERSION	1
+
+/*
+ * MCMC snapshot (--checkpoint): genotype graphs (Variants, Ambiguous, Diplotypes, Lengths, ProbMask,
+ * ProbStored), IBD2 constraints, RNG state and the next iteration to run. Main haplotypes are not stored
+ * since they are rebuilt from the Variants bits; reference haplotypes come from the input files.
+ * The state is serialised in memory by the calling thread, then written to disk by a background thread.
+ */
+class checkpoint_writer {
+public:
+	//DATA
+	haplotype_set & H;
+	genotype_set & G;
+	string fname;
+	vector < char > buffer;
+	pthread_t id_writer;
+	bool writing;
+
+	//CONSTRUCTORS/DESCTRUCTORS
+	checkpoint_writer(haplotype_set &, genotype_set &);
+	~checkpoint_writer();
+
+	//IO
+	void writeCheckpoint(string, string, unsigned int, unsigned int);
+	void flush();
+	void wait();
+
+	//SERIALISATION
+	template < class T > void put(const T & v);
+	template < class T > void put(const T * v, unsigned long n);
+	void put(const vector < bool > & v);
+	void put(const string & s);
+};
+
+template < class T >
+inline
+void checkpoint_writer::put(const T & v) {
+	const char * p = reinterpret_cast < const char * > (&v);
+	buffer.insert(buffer.end(), p, p + sizeof(T));
+}
+
+template < class T >
+inline
+void checkpoint_writer::put(const T * v, unsigned long n) {
+	const char * p = reinterpret_cast < const char * > (v);
+	buffer.insert(buffer.end(), p, p + n * sizeof(T));
+}
+
+inline
+void checkpoint_writer::put(const vector < bool > & v) {
+	put((unsigned long)v.size());
+	for (unsigned long b = 0 ; b < v.size() ; b += 8) {
+		unsigned char byte = 0;
+		for (unsigned long e = b ; e < min(b + 8, (unsigned long)v.size()) ; e ++) byte |= (v[e] << (e - b));
+		put(byte);
+	}
+}
+
+inline
+void checkpoint_writer::put(const string & s) {
+	put((unsigned long)s.size());
+	put(s.data(), s.size());
+}
+
+#endif
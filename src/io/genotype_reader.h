@@ -56,11 +56,15 @@ public:
 	//IO
 	void scanGenotypes(string funphased);
 	void scanGenotypes(string funphased, string fphased);
-	void allocateGenotypes();
+	void scanGenotypes(string funphased, haplotype_set & Hres, variant_map & Vres);
+	void scanReference(string fphased);
+	void allocateGenotypes(string ooc_dir = "");
 	void readGenotypes0(string);
 	void readGenotypes1(string, string);
 	void readGenotypes2(string, string);
 	void readGenotypes3(string, string, string);
+	void readGenotypes4(string, haplotype_set &, variant_map &);
+	void readReference(string, string ooc_dir = "");
 	void setPScodes(int * ps_arr, int nps);
 };
 
@@ -41,23 +41,16 @@ genotype_reader::~genotype_reader() {
 	region = "";
 }
 
-void genotype_reader::allocateGenotypes() {
+void genotype_reader::allocateGenotypes(string ooc_dir) {
 	assert(n_variants != 0 && (n_main_samples+n_ref_samples) != 0);
 	//Genotypes
-	G.vecG = vector < genotype * > (n_main_samples);
-	for (unsigned int i = 0 ; i < n_main_samples ; i ++) {
-		G.vecG[i] = new genotype (i);
-		G.vecG[i]->n_variants = n_variants;
-		G.vecG[i]->Variants = vector < unsigned char > (DIV2(n_variants) + MOD2(n_variants), 0);
-	}
-	G.n_ind = n_main_samples;
-	G.n_site = n_variants;
+	G.allocate(n_main_samples, n_variants);
 	//Haplotypes
 	H.n_ind = n_main_samples;
 	H.n_hap = 2 * (n_main_samples + n_ref_samples);
 	H.n_site = n_variants;
-	H.H_opt_var.allocate(H.n_site, H.n_hap);
-	H.H_opt_hap.allocate(H.n_hap, H.n_site);
+	H.H_opt_var.allocate(H.n_site, H.n_hap, ooc_dir);
+	H.H_opt_hap.allocate(H.n_hap, H.n_site, ooc_dir);
 }
 
 void genotype_reader::setPScodes(int * ps_arr, int nps) {
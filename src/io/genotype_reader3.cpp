@@ -0,0 +1,187 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2018 Olivier Delaneau, University of Lausanne
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+#include <io/genotype_reader.h>
+
+//**********************************************************************************//
+//								RESIDENT REFERENCE PANEL (--server)					//
+//								1. reference haplotype data, read once				//
+//								2. main genotype data, read for each job			//
+//**********************************************************************************//
+void genotype_reader::scanReference(string fref) {
+	vrb.wait("  * VCF/BCF scanning");
+	tac.clock();
+	bcf_srs_t * sr =  bcf_sr_init();
+	if (bcf_sr_set_regions(sr, region.c_str(), 0) == -1) vrb.error("Impossible to jump to region [" + region + "] in [" + fref + "]");
+	if(!(bcf_sr_add_reader (sr, fref.c_str()))) vrb.error("Problem opening index file for [" + fref + "]");
+	n_variants = 0;
+	n_main_samples = 0;
+	n_ref_samples = bcf_hdr_nsamples(sr->readers[0].header);
+	bcf1_t * line;
+	while(bcf_sr_next_line (sr)) {
+		line =  bcf_sr_get_line(sr, 0);
+		if (line->n_allele == 2) n_variants++;
+	}
+	bcf_sr_destroy(sr);
+	if (n_variants == 0) vrb.error("No variants in the reference panel [" + fref + "]");
+	vrb.bullet("VCF/BCF scanning [Nr=" + stb.str(n_ref_samples) + " / L=" + stb.str(n_variants) + " / Reg=" + region + "] (" + stb.str(tac.rel_time()*1.0/1000, 2) + "s)");
+}
+
+/*
+ * The reference haplotypes are the only rows of H (n_ind = 0). H_opt_var is not needed: each job copies
+ * the rows it uses into a haplotype_set of its own.
+ */
+void genotype_reader::readReference(string fref, string ooc_dir) {
+	tac.clock();
+	H.n_ind = 0;
+	H.n_hap = 2 * n_ref_samples;
+	H.n_site = n_variants;
+	H.H_opt_hap.allocate(H.n_hap, H.n_site, ooc_dir);
+	bcf_srs_t * sr =  bcf_sr_init();
+	bcf_sr_set_regions(sr, region.c_str(), 0);
+	bcf_sr_add_reader(sr, fref.c_str());
+	bcf1_t * line;
+	int ngt_ref, *gt_arr_ref = NULL, ngt_arr_ref = 0;
+	unsigned int i_variant = 0, n_ref_missing = 0, n_ref_unphased = 0;
+	while(bcf_sr_next_line (sr)) {
+		line =  bcf_sr_get_line(sr, 0);
+		if (line->n_allele == 2) {
+			bcf_unpack(line, BCF_UN_STR);
+			string chr = bcf_hdr_id2name(sr->readers[0].header, line->rid);
+			unsigned int pos = line->pos + 1;
+			string id = string(line->d.id);
+			string ref = string(line->d.allele[0]);
+			string alt = string(line->d.allele[1]);
+			variant * newV = new variant (chr, pos, id, ref, alt, V.size());
+			unsigned int cref = 0, calt = 0;
+			ngt_ref = bcf_get_genotypes(sr->readers[0].header, line, &gt_arr_ref, &ngt_arr_ref); assert(ngt_ref == 2 * n_ref_samples);
+			for(int i = 0 ; i < 2 * n_ref_samples ; i += 2) {
+				bool a0 = (bcf_gt_allele(gt_arr_ref[i+0])==1);
+				bool a1 = (bcf_gt_allele(gt_arr_ref[i+1])==1);
+				n_ref_missing += (gt_arr_ref[i+0] == bcf_gt_missing || gt_arr_ref[i+1] == bcf_gt_missing);
+				n_ref_unphased += !bcf_gt_is_phased(gt_arr_ref[i+1]);
+				H.H_opt_hap.set(i+0, i_variant, a0);
+				H.H_opt_hap.set(i+1, i_variant, a1);
+				a0?calt++:cref++;
+				a1?calt++:cref++;
+			}
+			newV->cref = cref;newV->calt = calt;
+			V.push(newV);
+			i_variant ++;
+			vrb.progress("  * VCF/BCF parsing", i_variant*1.0/n_variants);
+		}
+	}
+	free(gt_arr_ref);
+	bcf_sr_destroy(sr);
+	vrb.bullet("VCF/BCF parsing [Reference resident / " + stb.str(H.H_opt_hap.n_bytes * 1.0 / (1 << 20), 1) + "MB] (" + stb.str(tac.rel_time()*1.0/1000, 2) + "s)");
+	if (n_ref_missing > 0) vrb.warning(stb.str(n_ref_missing) + " missing genotypes in the reference panel (randomly imputed)");
+	if (n_ref_unphased > 0) vrb.warning(stb.str(n_ref_unphased) + " unphased genotypes in the reference panel (randomly phased)");
+}
+
+void genotype_reader::scanGenotypes(string fmain, haplotype_set & Hres, variant_map & Vres) {
+	vrb.wait("  * VCF/BCF scanning");
+	tac.clock();
+	bcf_srs_t * sr =  bcf_sr_init();
+	if (bcf_sr_set_regions(sr, region.c_str(), 0) == -1) vrb.error("Impossible to jump to region [" + region + "] in [" + fmain + "]");
+	if(!(bcf_sr_add_reader (sr, fmain.c_str()))) vrb.error("Problem opening index file for [" + fmain + "]");
+	n_variants = 0;
+	n_main_samples = bcf_hdr_nsamples(sr->readers[0].header);
+	n_ref_samples = Hres.n_hap / 2;
+	bcf1_t * line;
+	while(bcf_sr_next_line (sr)) {
+		line =  bcf_sr_get_line(sr, 0);
+		if (line->n_allele == 2) {
+			bcf_unpack(line, BCF_UN_STR);
+			string ref = string(line->d.allele[0]);
+			string alt = string(line->d.allele[1]);
+			if (Vres.getByRef(line->pos + 1, ref, alt).size() > 0) n_variants ++;
+		}
+	}
+	bcf_sr_destroy(sr);
+	if (n_variants == 0) vrb.error("No variants to be phased in files");
+	vrb.bullet("VCF/BCF scanning [Nm=" + stb.str(n_main_samples) + " / Nr=" + stb.str(n_ref_samples) + " / L=" + stb.str(n_variants) + " / Reg=" + region + "] (" + stb.str(tac.rel_time()*1.0/1000, 2) + "s)");
+}
+
+/*
+ * Same as readGenotypes1, except that reference haplotypes and genetic positions are copied from the
+ * resident panel instead of being decoded from a second VCF/BCF file.
+ */
+void genotype_reader::readGenotypes4(string funphased, haplotype_set & Hres, variant_map & Vres) {
+	tac.clock();
+	bcf_srs_t * sr =  bcf_sr_init();
+	bcf_sr_set_regions(sr, region.c_str(), 0);
+	bcf_sr_add_reader(sr, funphased.c_str());
+	for (int i = 0 ; i < n_main_samples ; i ++) G.vecG[i]->name = string(sr->readers[0].header->samples[i]);
+	bcf1_t * line;
+	int ngt_main, *gt_arr_main = NULL, ngt_arr_main = 0;
+	unsigned int i_variant = 0;
+	while(bcf_sr_next_line (sr)) {
+		line =  bcf_sr_get_line(sr, 0);
+		if (line->n_allele == 2) {
+			bcf_unpack(line, BCF_UN_STR);
+			string ref = string(line->d.allele[0]);
+			string alt = string(line->d.allele[1]);
+			vector < variant * > vecR = Vres.getByRef(line->pos + 1, ref, alt);
+			if (vecR.size() == 0) continue;
+			string chr = bcf_hdr_id2name(sr->readers[0].header, line->rid);
+			unsigned int pos = line->pos + 1;
+			string id = string(line->d.id);
+			variant * newV = new variant (chr, pos, id, ref, alt, V.size());
+			unsigned int cref = 0, calt = 0, cmis = 0;
+			ngt_main = bcf_get_genotypes(sr->readers[0].header, line, &gt_arr_main, &ngt_arr_main);
+			assert(ngt_main == 2 * n_main_samples);
+			for(int i = 0 ; i < 2 * n_main_samples ; i += 2) {
+				bool a0 = (bcf_gt_allele(gt_arr_main[i+0])==1);
+				bool a1 = (bcf_gt_allele(gt_arr_main[i+1])==1);
+				bool mi = (gt_arr_main[i+0] == bcf_gt_missing || gt_arr_main[i+1] == bcf_gt_missing);
+				bool he = !mi && a0 != a1;
+				bool ho = !mi && a0 == a1;
+				if (a0) VAR_SET_HAP0(MOD2(i_variant), G.vecG[DIV2(i)]->Variants[DIV2(i_variant)]);
+				if (a1) VAR_SET_HAP1(MOD2(i_variant), G.vecG[DIV2(i)]->Variants[DIV2(i_variant)]);
+				if (mi) VAR_SET_MIS(MOD2(i_variant), G.vecG[DIV2(i)]->Variants[DIV2(i_variant)]);
+				if (he) VAR_SET_HET(MOD2(i_variant), G.vecG[DIV2(i)]->Variants[DIV2(i_variant)]);
+				if (!mi) { a0?calt++:cref++; a1?calt++:cref++; }
+				else cmis ++;
+				n_geno_het += he;
+				n_geno_hom += ho;
+				n_geno_mis += mi;
+			}
+			for (unsigned int h = 0 ; h < 2 * n_ref_samples ; h ++) H.H_opt_hap.set(h+2*n_main_samples, i_variant, Hres.H_opt_hap.get(h, vecR[0]->idx));
+			newV->cref = cref + vecR[0]->cref;newV->calt = calt + vecR[0]->calt;newV->cmis = cmis;
+			newV->cm = vecR[0]->cm;
+			V.push(newV);
+			i_variant ++;
+			vrb.progress("  * VCF/BCF parsing", i_variant*1.0/n_variants);
+		}
+	}
+	free(gt_arr_main);
+	bcf_sr_destroy(sr);
+	//Same baseline as variant_map::setGeneticMap
+	double baseline = V.vec_pos[0]->cm;
+	for (int l = 0 ; l < V.size() ; l ++) V.vec_pos[l]->cm -= baseline;
+	// Report
+	n_geno_tot = n_main_samples*n_variants;
+	string str0 = "Hom=" + stb.str(n_geno_hom*100.0/n_geno_tot, 1) + "%";
+	string str1 = "Het=" + stb.str(n_geno_het*100.0/n_geno_tot, 1) + "%";
+	string str2 = "Mis=" + stb.str(n_geno_mis*100.0/n_geno_tot, 1) + "%";
+	string str3 = stb.str(tac.rel_time()*1.0/1000, 2) + "s";
+	vrb.bullet("VCF/BCF parsing ["+str0+" / "+str1+" / "+str2+"] ("+str3+")");
+}
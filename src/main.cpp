@@ -19,7 +19,6 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 // SOFTWARE.
 ////////////////////////////////////////////////////////////////////////////////
-#define _DECLARE_TOOLBOX_HERE
 #include <phaser/phaser_header.h>
 
 int main(int argc, char ** argv) {
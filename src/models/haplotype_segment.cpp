@@ -39,10 +39,12 @@ haplotype_segment::haplotype_segment(genotype * _G, bitmatrix & _H, vector < uns
 	probSumK2 = aligned_vector32 < float > (n_cond_haps, 1.0);
 	probSumT1 = 1.0;
 	probSumT2 = 1.0;
-	Alpha = vector < aligned_vector32 < float > > (segment_last - segment_first + 1, aligned_vector32 < float > (HAP_NUMBER * n_cond_haps, 0.0));
-	Beta = vector < aligned_vector32 < float > > (segment_last - segment_first + 1, aligned_vector32 < float > (HAP_NUMBER * n_cond_haps, 0.0));
+	Alpha = vector < aligned_vector32 < hmm_stored > > (segment_last - segment_first + 1, aligned_vector32 < hmm_stored > (HAP_NUMBER * n_cond_haps, 0));
+	Beta = vector < aligned_vector32 < hmm_stored > > (segment_last - segment_first + 1, aligned_vector32 < hmm_stored > (HAP_NUMBER * n_cond_haps, 0));
 	AlphaSum = vector < aligned_vector32 < float > > (segment_last - segment_first + 1, aligned_vector32 < float > (HAP_NUMBER, 0.0));
 	AlphaSumSum = aligned_vector32 < float > (segment_last - segment_first + 1, 0.0);
+	AlphaScale = vector < aligned_vector32 < float > > (segment_last - segment_first + 1, aligned_vector32 < float > (HAP_NUMBER, 1.0));
+	BetaScale = vector < aligned_vector32 < float > > (segment_last - segment_first + 1, aligned_vector32 < float > (HAP_NUMBER, 1.0));
 	BetaSum = aligned_vector32 < float > (HAP_NUMBER, 0.0);
 }
 
@@ -75,6 +77,8 @@ haplotype_segment::~haplotype_segment() {
 	Beta.clear();
 	AlphaSum.clear();
 	AlphaSumSum.clear();
+	AlphaScale.clear();
+	BetaScale.clear();
 	BetaSum.clear();
 }
 
@@ -98,7 +102,7 @@ void haplotype_segment::forward() {
 		if (curr_segment_locus == G->Lengths[curr_segment_index] - 1) {
 			//if (paired) copy(prob2.begin(), prob2.end(), Alpha[curr_segment_index - segment_first].begin());
 			//else copy(prob1.begin(), prob1.end(), Alpha[curr_segment_index - segment_first].begin());
-			Alpha[curr_segment_index - segment_first] = (paired?prob2:prob1);		//does not compile with aligned vectors (needs to define operator = from std vector)
+			STORE(Alpha[curr_segment_index - segment_first], paired?prob2:prob1, AlphaScale[curr_segment_index - segment_first]);
 			AlphaSum[curr_segment_index - segment_first] = (paired?probSumH2:probSumH1);
 			AlphaSumSum[curr_segment_index - segment_first] = (paired?probSumT2:probSumT1);
 		}
@@ -128,7 +132,7 @@ void haplotype_segment::backward() {
 		SUM(paired);
 		if (curr_segment_locus == 0) SUMK(paired);
 		if (curr_segment_locus == 0 && curr_abs_locus != locus_first) {
-			Beta[curr_segment_index - segment_first] = (paired?prob2:prob1);	//does not compile with aligned vectors (needs to define operator = from std vector)
+			STORE(Beta[curr_segment_index - segment_first], paired?prob2:prob1, BetaScale[curr_segment_index - segment_first]);
 			//if (paired) copy(prob2.begin(), prob2.end(), Beta[curr_segment_index - segment_first].begin());
 			//else copy(prob1.begin(), prob1.end(), Beta[curr_segment_index - segment_first].begin());
 		}
@@ -143,8 +147,17 @@ void haplotype_segment::backward() {
 }
 
 int haplotype_segment::expectation(vector < double > & transition_probabilities) {
+#ifdef HMM_COUNTERS
+	uint64_t counts [HWC_STAGES + 1][HWC_NUMBER];
+	thread_counters().read(counts[HWC_FORWARD]);
 	forward();
+	thread_counters().read(counts[HWC_BACKWARD]);
 	backward();
+	thread_counters().read(counts[HWC_POSTERIOR]);
+#else
+	forward();
+	backward();
+#endif
 
 	unsigned int n_transitions = 0;
 	if (!segment_first) {
@@ -207,6 +220,10 @@ int haplotype_segment::expectation(vector < double > & transition_probabilities)
 			curr_segment_locus = 0;
 		}
 	}
+#ifdef HMM_COUNTERS
+	thread_counters().read(counts[HWC_STAGES]);
+	thread_profile().push(n_cond_haps, locus_last - locus_first + 1, counts);
+#endif
 	return n_underflow_recovered;
 }
 
@@ -25,11 +25,26 @@
 #include <utils/otools.h>
 #include <objects/compute_job.h>
 #include <objects/hmm_parameters.h>
+#include <utils/hw_counters.h>
 
-#ifdef __AVX2__
+#if defined(__AVX2__) || defined(HMM_HALF)
 	#include <immintrin.h>
 #endif
 
+//Alpha and Beta are stored in half precision when compiled with -DHMM_HALF; the recursion itself stays in float
+#ifdef HMM_HALF
+	#ifndef __F16C__
+		#error "HMM_HALF requires F16C conversions (compile with -mf16c)"
+	#endif
+	typedef unsigned short hmm_stored;
+	#define HMM_LOAD1(p)	_cvtsh_ss(p)
+	#define HMM_LOAD8(p)	_mm256_cvtph_ps(_mm_load_si128((const __m128i *)(p)))
+#else
+	typedef float hmm_stored;
+	#define HMM_LOAD1(p)	(p)
+	#define HMM_LOAD8(p)	_mm256_load_ps(p)
+#endif
+
 #include <boost/align/aligned_allocator.hpp>
 
 template <typename T>
@@ -38,7 +53,7 @@ using aligned_vector32 = std::vector<T, boost::alignment::aligned_allocator < T,
 class haplotype_segment {
 private:
 	//EXTERNAL DATA
-	bitmatrix & H;
+	bitmatrix & H;						//Conditioning haplotypes of the window, locus first (see compute_job::gather)
 	vector < unsigned int > & idxH;
 	hmm_parameters & M;
 	genotype * G;
@@ -72,10 +87,12 @@ private:
 	aligned_vector32 < float > probSumK2;
 	aligned_vector32 < float > probSumH1;
 	aligned_vector32 < float > probSumH2;
-	vector < aligned_vector32 < float > > Alpha;
-	vector < aligned_vector32 < float > > Beta;
+	vector < aligned_vector32 < hmm_stored > > Alpha;
+	vector < aligned_vector32 < hmm_stored > > Beta;
 	vector < aligned_vector32 < float > > AlphaSum;
 	aligned_vector32 < float > AlphaSumSum;
+	vector < aligned_vector32 < float > > AlphaScale;	//Per haplotype factor to apply when reading Alpha back (1 unless HMM_HALF)
+	vector < aligned_vector32 < float > > BetaScale;	//Per haplotype factor to apply when reading Beta back (1 unless HMM_HALF)
 	aligned_vector32 < float > BetaSum;
 
 
@@ -95,6 +112,7 @@ private:
 	void RUN(bool, bool);
 	bool TRANSH();
 	bool TRANSD(int &);
+	void STORE(aligned_vector32 < hmm_stored > &, aligned_vector32 < float > &, aligned_vector32 < float > &);
 
 public:
 	//CONSTRUCTOR/DESTRUCTOR
@@ -109,15 +127,16 @@ public:
 inline
 void haplotype_segment::HOM(bool paired) {
 	bool ag = VAR_GET_HAP0(MOD2(curr_abs_locus), G->Variants[DIV2(curr_abs_locus)]);
+	const unsigned char * Hl = H.bytes + ((unsigned long)curr_rel_locus) * (H.n_cols/8);
 	if (paired) {
 		for(int k = 0, i = 0 ; k != n_cond_haps ; ++k, i += HAP_NUMBER) {
-			bool ah = H.get(idxH[k], curr_abs_locus);
+			bool ah = (Hl[k>>3] >> (7 - (k&7))) & 1;
 			if (ag != ah) fill(prob2.begin() + i, prob2.begin() + i + HAP_NUMBER, M.ed);
 			else fill(prob2.begin() + i, prob2.begin() + i + HAP_NUMBER, M.ee);
 		}
 	} else {
 		for(int k = 0, i = 0 ; k != n_cond_haps ; ++k, i += HAP_NUMBER) {
-			bool ah = H.get(idxH[k], curr_abs_locus);
+			bool ah = (Hl[k>>3] >> (7 - (k&7))) & 1;
 			if (ag != ah) fill(prob1.begin() + i, prob1.begin() + i + HAP_NUMBER, M.ed);
 			else fill(prob1.begin() + i, prob1.begin() + i + HAP_NUMBER, M.ee);
 		}
@@ -143,15 +162,16 @@ void haplotype_segment::AMB(bool paired) {
 	galleles1[5] = HAP_GET(G->Ambiguous[curr_abs_ambiguous],5)?M.ee:M.ed;
 	galleles1[6] = HAP_GET(G->Ambiguous[curr_abs_ambiguous],6)?M.ee:M.ed;
 	galleles1[7] = HAP_GET(G->Ambiguous[curr_abs_ambiguous],7)?M.ee:M.ed;
+	const unsigned char * Hl = H.bytes + ((unsigned long)curr_rel_locus) * (H.n_cols/8);
 	if (paired) {
 		for(int k = 0, i = 0 ; k != n_cond_haps ; ++k, i += HAP_NUMBER) {
-			bool a = H.get(idxH[k], curr_abs_locus);
+			bool a = (Hl[k>>3] >> (7 - (k&7))) & 1;
 			if (a) memcpy(&prob2[i], &galleles1[0], HAP_NUMBER*sizeof(float));
 			else memcpy(&prob2[i], &galleles0[0], HAP_NUMBER*sizeof(float));
 		}
 	} else {
 		for(int k = 0, i = 0 ; k != n_cond_haps ; ++k, i += HAP_NUMBER) {
-			bool a = H.get(idxH[k], curr_abs_locus);
+			bool a = (Hl[k>>3] >> (7 - (k&7))) & 1;
 			if (a) memcpy(&prob1[i], &galleles1[0], HAP_NUMBER*sizeof(float));
 			else memcpy(&prob1[i], &galleles0[0], HAP_NUMBER*sizeof(float));
 		}
@@ -252,15 +272,18 @@ bool haplotype_segment::TRANSH() {
 	for (int h1 = 0 ; h1 < HAP_NUMBER ; h1++) {
 		__m256 _sum = _mm256_set1_ps(0.0f);
 
-		float fact1 = M.nt[curr_abs_locus-1] / AlphaSumSum[curr_rel_segment_index - 1];
+		float fact1 = M.nt[curr_abs_locus-1] * AlphaScale[curr_rel_segment_index - 1][h1] / AlphaSumSum[curr_rel_segment_index - 1];
 		float fact2 = (AlphaSum[curr_rel_segment_index - 1][h1]/AlphaSumSum[curr_rel_segment_index - 1]) * M.t[curr_abs_locus - 1] / n_cond_haps;
 
 		for (int k = 0 ; k < n_cond_haps ; k ++) {
-			float alpha = Alpha[curr_rel_segment_index - 1][k*HAP_NUMBER + h1] * fact1 + fact2;
+			float alpha = HMM_LOAD1(Alpha[curr_rel_segment_index - 1][k*HAP_NUMBER + h1]) * fact1 + fact2;
 			__m256 _alpha = _mm256_set1_ps(alpha);
-			__m256 _beta = _mm256_load_ps(&Beta[curr_rel_segment_index][k*HAP_NUMBER]);
+			__m256 _beta = HMM_LOAD8(&Beta[curr_rel_segment_index][k*HAP_NUMBER]);
 			_sum = _mm256_add_ps(_sum, _mm256_mul_ps(_alpha, _beta));
 		}
+#ifdef HMM_HALF
+		_sum = _mm256_mul_ps(_sum, _mm256_load_ps(&BetaScale[curr_rel_segment_index][0]));
+#endif
 		_mm256_store_ps(&HProbs[h1*HAP_NUMBER], _sum);
 		sumHProbs += HProbs[h1*HAP_NUMBER+0]+HProbs[h1*HAP_NUMBER+1]+HProbs[h1*HAP_NUMBER+2]+HProbs[h1*HAP_NUMBER+3]+HProbs[h1*HAP_NUMBER+4]+HProbs[h1*HAP_NUMBER+5]+HProbs[h1*HAP_NUMBER+6]+HProbs[h1*HAP_NUMBER+7];
 	}
@@ -401,22 +424,32 @@ bool haplotype_segment::TRANSH() {
 	for (int h1 = 0 ; h1 < HAP_NUMBER ; h1++) {
 		float sum0 = 0.0, sum1 = 0.0, sum2 = 0.0, sum3 = 0.0, sum4 = 0.0, sum5 = 0.0, sum6 = 0.0, sum7 = 0.0;
 
-		float fact1 = M.nt[curr_abs_locus-1] / AlphaSumSum[curr_rel_segment_index - 1];
+		float fact1 = M.nt[curr_abs_locus-1] * AlphaScale[curr_rel_segment_index - 1][h1] / AlphaSumSum[curr_rel_segment_index - 1];
 		float fact2 = (AlphaSum[curr_rel_segment_index - 1][h1]/AlphaSumSum[curr_rel_segment_index - 1]) * M.t[curr_abs_locus - 1] / n_cond_haps;
 
 		for (int k = 0 ; k < n_cond_haps ; k ++) {
 			//float alpha = Alpha[curr_rel_segment_index - 1][k*HAP_NUMBER + h1] * M.nt[curr_abs_locus-1] + AlphaSum[curr_rel_segment_index - 1][h1] * M.tfreq[curr_abs_locus - 1];
 			//float alpha = Alpha[curr_rel_segment_index - 1][k*HAP_NUMBER + h1] * M.nt[curr_abs_locus-1] + AlphaSum[curr_rel_segment_index - 1][h1] * M.t[curr_abs_locus - 1] / n_cond_haps;
-			float alpha = Alpha[curr_rel_segment_index - 1][k*HAP_NUMBER + h1] * fact1 + fact2;
-			sum0 += alpha * Beta[curr_rel_segment_index][k*HAP_NUMBER + 0];
-			sum1 += alpha * Beta[curr_rel_segment_index][k*HAP_NUMBER + 1];
-			sum2 += alpha * Beta[curr_rel_segment_index][k*HAP_NUMBER + 2];
-			sum3 += alpha * Beta[curr_rel_segment_index][k*HAP_NUMBER + 3];
-			sum4 += alpha * Beta[curr_rel_segment_index][k*HAP_NUMBER + 4];
-			sum5 += alpha * Beta[curr_rel_segment_index][k*HAP_NUMBER + 5];
-			sum6 += alpha * Beta[curr_rel_segment_index][k*HAP_NUMBER + 6];
-			sum7 += alpha * Beta[curr_rel_segment_index][k*HAP_NUMBER + 7];
+			float alpha = HMM_LOAD1(Alpha[curr_rel_segment_index - 1][k*HAP_NUMBER + h1]) * fact1 + fact2;
+			sum0 += alpha * HMM_LOAD1(Beta[curr_rel_segment_index][k*HAP_NUMBER + 0]);
+			sum1 += alpha * HMM_LOAD1(Beta[curr_rel_segment_index][k*HAP_NUMBER + 1]);
+			sum2 += alpha * HMM_LOAD1(Beta[curr_rel_segment_index][k*HAP_NUMBER + 2]);
+			sum3 += alpha * HMM_LOAD1(Beta[curr_rel_segment_index][k*HAP_NUMBER + 3]);
+			sum4 += alpha * HMM_LOAD1(Beta[curr_rel_segment_index][k*HAP_NUMBER + 4]);
+			sum5 += alpha * HMM_LOAD1(Beta[curr_rel_segment_index][k*HAP_NUMBER + 5]);
+			sum6 += alpha * HMM_LOAD1(Beta[curr_rel_segment_index][k*HAP_NUMBER + 6]);
+			sum7 += alpha * HMM_LOAD1(Beta[curr_rel_segment_index][k*HAP_NUMBER + 7]);
 		}
+#ifdef HMM_HALF
+		sum0 *= BetaScale[curr_rel_segment_index][0];
+		sum1 *= BetaScale[curr_rel_segment_index][1];
+		sum2 *= BetaScale[curr_rel_segment_index][2];
+		sum3 *= BetaScale[curr_rel_segment_index][3];
+		sum4 *= BetaScale[curr_rel_segment_index][4];
+		sum5 *= BetaScale[curr_rel_segment_index][5];
+		sum6 *= BetaScale[curr_rel_segment_index][6];
+		sum7 *= BetaScale[curr_rel_segment_index][7];
+#endif
 		HProbs[h1*HAP_NUMBER+0] = sum0;
 		HProbs[h1*HAP_NUMBER+1] = sum1;
 		HProbs[h1*HAP_NUMBER+2] = sum2;
@@ -433,6 +466,27 @@ bool haplotype_segment::TRANSH() {
 #endif
 
 
+/*
+ * Copies the current message into Alpha or Beta, with the factor to apply to each haplotype when reading it back.
+ * In half precision, each haplotype column is divided by its largest entry so that it fits the FP16 range and
+ * keeps full precision for the conditioning haplotypes that dominate it.
+ */
+inline
+void haplotype_segment::STORE(aligned_vector32 < hmm_stored > & dst, aligned_vector32 < float > & src, aligned_vector32 < float > & scale) {
+#ifdef HMM_HALF
+	__m256 _max = _mm256_setzero_ps();
+	for (int i = 0 ; i < src.size() ; i += HAP_NUMBER) _max = _mm256_max_ps(_max, _mm256_load_ps(&src[i]));
+	__m256 _zero = _mm256_cmp_ps(_max, _mm256_setzero_ps(), _CMP_EQ_OQ);
+	_max = _mm256_blendv_ps(_max, _mm256_set1_ps(1.0f), _zero);
+	_mm256_store_ps(&scale[0], _max);
+	__m256 _inv = _mm256_div_ps(_mm256_set1_ps(1.0f), _max);
+	for (int i = 0 ; i < src.size() ; i += HAP_NUMBER)
+		_mm_store_si128((__m128i *)&dst[i], _mm256_cvtps_ph(_mm256_mul_ps(_mm256_load_ps(&src[i]), _inv), _MM_FROUND_TO_NEAREST_INT));
+#else
+	dst = src;
+#endif
+}
+
 inline
 bool haplotype_segment::TRANSD(int & n_underflows_recovered) {
 	sumDProbs= 0.0;
@@ -0,0 +1,99 @@
+/*******************************************************************************
+ * Copyright (C) 2018 Olivier Delaneau, University of Lausanne
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#ifndef _PBWT_KERNEL_H
+#define _PBWT_KERNEL_H
+
+#include <utils/otools.h>
+
+/*
+ * Prefix and divergence arrays of a PBWT, updated one column at a time.
+ * The column is given as one key byte per element (see bitmatrix::unpack), so that each step is a
+ * single branch-free M-way stable partition: every element is written at the running prefix count
+ * of all M classes and only the cursor of its own class moves. Class 0 is partitioned in place, the
+ * other classes go through scratch buffers and are appended afterwards.
+ */
+class pbwt_kernel {
+public:
+	unsigned int n;
+	vector < int > A;			//Prefix array
+	vector < int > D;			//Divergence array
+	vector < int > Abuf, Dbuf;	//Scratch for classes 1..M-1
+
+	pbwt_kernel() {
+		n = 0;
+	}
+
+	void allocate(unsigned int _n, unsigned int M = 2) {
+		n = _n;
+		A = vector < int > (n, 0);
+		D = vector < int > (n, 0);
+		Abuf = vector < int > ((M - 1) * n, 0);
+		Dbuf = vector < int > ((M - 1) * n, 0);
+		reset();
+	}
+
+	void free() {
+		n = 0;
+		vector < int > ().swap(A);
+		vector < int > ().swap(D);
+		vector < int > ().swap(Abuf);
+		vector < int > ().swap(Dbuf);
+	}
+
+	void reset() {
+		for (unsigned int e = 0 ; e < n ; e ++) { A[e] = e; D[e] = 0; }
+	}
+
+	template < int M >
+	void update(const unsigned char * key, int l);
+};
+
+template < int M >
+inline
+void pbwt_kernel::update(const unsigned char * key, int l) {
+	assert(Abuf.size() >= (M - 1) * n);
+	int U[M], P[M];
+	for (int g = 0 ; g < M ; g ++) { U[g] = 0; P[g] = l; }
+	int * a0 = A.data(), * d0 = D.data(), * ab = Abuf.data(), * db = Dbuf.data();
+	for (unsigned int e = 0 ; e < n ; e ++) {
+		int alookup = a0[e], dlookup = d0[e], k = key[alookup];
+		for (int g = 0 ; g < M ; g ++) P[g] = max(P[g], dlookup);
+		a0[U[0]] = alookup;
+		d0[U[0]] = P[0];
+		for (int g = 1 ; g < M ; g ++) {
+			ab[(g - 1) * n + U[g]] = alookup;
+			db[(g - 1) * n + U[g]] = P[g];
+		}
+		for (int g = 0 ; g < M ; g ++) {
+			int match = (k == g);
+			U[g] += match;
+			P[g] &= (match - 1);
+		}
+	}
+	for (int g = 1, offset = U[0] ; g < M ; g ++) {
+		std::copy(ab + (g - 1) * n, ab + (g - 1) * n + U[g], a0 + offset);
+		std::copy(db + (g - 1) * n, db + (g - 1) * n + U[g], d0 + offset);
+		offset += U[g];
+	}
+}
+
+#endif
@@ -52,15 +52,20 @@ void * builder_callback(void * ptr) {
 }
 
 void builder::build(int ind) {
-	G.vecG[ind]->build();
+	if (i_stage == 0) G.vecG[ind]->count();
+	else G.vecG[ind]->build();
 }
 
 void builder::build() {
 	tac.clock();
-	if (n_thread > 1) {
-		for (int t = 0 ; t < n_thread ; t++) pthread_create( &id_workers[t] , NULL, builder_callback, static_cast<void *>(this));
-		for (int t = 0 ; t < n_thread ; t++) pthread_join( id_workers[t] , NULL);
-	} else for (int i = 0 ; i  <  G.n_ind ; i ++) build(i);
+	for (i_stage = 0 ; i_stage < 2 ; i_stage ++) {
+		if (i_stage == 1) G.allocateGraphs();
+		if (n_thread > 1) {
+			i_workers = 0;
+			for (int t = 0 ; t < n_thread ; t++) pthread_create( &id_workers[t] , NULL, builder_callback, static_cast<void *>(this));
+			for (int t = 0 ; t < n_thread ; t++) pthread_join( id_workers[t] , NULL);
+		} else for (int i = 0 ; i  <  G.n_ind ; i ++) build(i);
+	}
 	long int n_segments = G.numberOfSegments();
 	vrb.bullet("Build genotype graphs [seg=" + stb.str(n_segments) + "] (" + stb.str(tac.rel_time()*0.001, 2) + "s)");
 }
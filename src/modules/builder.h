@@ -32,6 +32,7 @@ public:
 
 	//MULTI-THREADING
 	int i_workers;
+	int i_stage;				//0: count graph sizes, 1: build graphs
 	int n_thread;
 	pthread_mutex_t mutex_workers;
 	vector < pthread_t > id_workers;
@@ -27,15 +27,36 @@ pbwt_solver::pbwt_solver(haplotype_set & _H) : H(_H.H_opt_var) {
 	n_site = _H.n_site;
 	n_main_hap = 2 * _H.n_ind;
 	n_total_hap = _H.n_hap;
-	pbwt_clusters = vector < vector < int > > (2, vector < int > (n_total_hap, 0));
-	pbwt_indexes = vector < vector < int > > (2, vector < int > (n_total_hap, 0));
-	pbwt_divergences = vector < vector < int > > (2, vector < int > (n_total_hap, 0));
+	pbwt_arrays.allocate(n_total_hap);
+	pbwt_indexes = vector < int > (n_total_hap, 0);
+	Hrow = vector < unsigned char > (n_total_hap, 0);
 	Guess = vector < char > (n_total_hap, 0);
-	Het = vector < bool > (n_main_hap/2, 0);
-	Mis = vector < bool > (n_main_hap/2, 0);
-	Amb = vector < bool > (n_main_hap/2, 0);
+	GuessNext = vector < char > (n_main_hap, 0);
+	Het = vector < unsigned char > (n_main_hap/2, 0);
+	Mis = vector < unsigned char > (n_main_hap/2, 0);
+	Amb = vector < unsigned char > (n_main_hap/2, 0);
+	HetMask.allocate(n_main_hap/2, n_site);
+	MisMask.allocate(n_main_hap/2, n_site);
+	HetMaskVar.allocate(n_site, n_main_hap/2);
+	MisMaskVar.allocate(n_site, n_main_hap/2);
 	scoreBit = vector < float > (n_site, 0.0);
 	for (int l = 0 ; l < n_site ; ++l) scoreBit[l] = log (l + 1.0);
+
+	n_thread = max(1, (int)_H.nthreads);
+	nh_thread = vector < unsigned int > (n_thread, 0);
+	nm_thread = vector < unsigned int > (n_thread, 0);
+	hap_range = vector < pair < int, int > > (n_thread);
+	unsigned int n_words = (n_total_hap + 63) / 64;
+	for (int t = 0 ; t < n_thread ; t ++) {
+		hap_range[t].first = min(64 * (n_words * t / n_thread), n_total_hap);
+		hap_range[t].second = min(64 * (n_words * (t + 1) / n_thread), n_total_hap);
+	}
+	if (n_thread > 1) {
+		i_workers = 0;
+		id_workers = vector < pthread_t > (n_thread);
+		pthread_mutex_init(&mutex_workers, NULL);
+		pthread_barrier_init(&barrier_workers, NULL, n_thread);
+	}
 }
 
 pbwt_solver::~pbwt_solver() {
@@ -43,14 +64,111 @@ pbwt_solver::~pbwt_solver() {
 }
 
 void pbwt_solver::free() {
-	vector < vector < int > > ().swap(pbwt_clusters);
-	vector < vector < int > > ().swap(pbwt_indexes);
-	vector < vector < int > > ().swap(pbwt_divergences);
+	pbwt_arrays.free();
+	vector < int > ().swap(pbwt_indexes);
+	vector < unsigned char > ().swap(Hrow);
 	vector < char > ().swap(Guess);
-	vector < bool > ().swap(Het);
-	vector < bool > ().swap(Mis);
-	vector < bool > ().swap(Amb);
+	vector < char > ().swap(GuessNext);
+	vector < unsigned char > ().swap(Het);
+	vector < unsigned char > ().swap(Mis);
+	vector < unsigned char > ().swap(Amb);
 	vector < float > ().swap(scoreBit);
+	HetMask.free();
+	MisMask.free();
+	HetMaskVar.free();
+	MisMaskVar.free();
+	if (id_workers.size()) {
+		i_workers = 0;
+		pthread_mutex_destroy(&mutex_workers);
+		pthread_barrier_destroy(&barrier_workers);
+		id_workers.clear();
+	}
+}
+
+void * pbwt_solver_callback(void * ptr) {
+	pbwt_solver * S = static_cast< pbwt_solver * >( ptr );
+	pthread_mutex_lock( &S->mutex_workers );
+	int id_worker = S->i_workers++;
+	pthread_mutex_unlock( &S->mutex_workers);
+	S->sweep(id_worker);
+	pthread_exit(NULL);
+	return NULL;
+}
+
+void pbwt_solver::wait() {
+	if (n_thread > 1) pthread_barrier_wait(&barrier_workers);
+}
+
+/*
+ * Packs the Het and Mis status of the individuals of thread t into bit masks, then transposes them
+ * so that the status of 64 individuals at a given site is read as a single word.
+ */
+void pbwt_solver::prepare(int t) {
+	int i0 = min(hap_range[t].first, (int)n_main_hap) / 2, i1 = min(hap_range[t].second, (int)n_main_hap) / 2;
+	for (int i = i0 ; i < i1 ; i ++) {
+		const unsigned char * var = G->vecG[i]->Variants;
+		for (int l = 0 ; l < n_site ; l ++) {
+			if (VAR_GET_HET(MOD2(l), var[DIV2(l)])) HetMask.set(i, l, 1);
+			else if (VAR_GET_MIS(MOD2(l), var[DIV2(l)])) MisMask.set(i, l, 1);
+		}
+	}
+	wait();
+	if (t == 0) {
+		HetMask.transpose(HetMaskVar, n_main_hap/2, n_site);
+		MisMask.transpose(MisMaskVar, n_main_hap/2, n_site);
+		HetMask.free();
+		MisMask.free();
+	}
+	wait();
+}
+
+/*
+ * One round of neighbour votes at site l over the ambiguous genotypes of thread t.
+ * Votes read Guess and write GuessNext, so that the outcome does not depend on the number of threads.
+ */
+void pbwt_solver::vote(int t, int l, double thresh, bool final) {
+	int i0 = min(hap_range[t].first, (int)n_main_hap) / 2, i1 = min(hap_range[t].second, (int)n_main_hap) / 2;
+	unsigned int nh = 0, nm = 0;
+	for (int i = i0, h = 2 * i0 ; i < i1 ; ++i, h += 2) {
+		if (!Amb[i]) continue;
+		unsigned int hidx0 = pbwt_indexes[h+0];
+		unsigned int hidx1 = pbwt_indexes[h+1];
+		if (!final) {
+			if (Het[i]) {
+				double s = 0.0;
+				if (hidx0>0) s += Guess[pbwt_arrays.A[hidx0-1]];
+				if (hidx0<(n_total_hap-1)) s += Guess[pbwt_arrays.A[hidx0+1]];
+				if (hidx1>0) s -= Guess[pbwt_arrays.A[hidx1-1]];
+				if (hidx1<(n_total_hap-1)) s -= Guess[pbwt_arrays.A[hidx1+1]];
+				if (s > thresh) { GuessNext[h+0] = 1; GuessNext[h+1] = -1; Amb[i] = false; }
+				else if (s < -thresh) { GuessNext[h+0] = -1; GuessNext[h+1] = 1; Amb[i] = false; }
+				else ++nh;
+			} else {
+				double s0 = 0.0, s1 = 0.0;
+				if (hidx0>0) s0 += Guess[pbwt_arrays.A[hidx0-1]];
+				if (hidx0<(n_total_hap-1)) s0 += Guess[pbwt_arrays.A[hidx0+1]];
+				if (hidx1>0) s1 += Guess[pbwt_arrays.A[hidx1-1]];
+				if (hidx1<(n_total_hap-1)) s1 += Guess[pbwt_arrays.A[hidx1+1]];
+				if ((s0 == -2 || s0 == 2) && (s1 == -2 || s1 == 2)) { GuessNext[h+0] = (s0 > 0)?1:-1; GuessNext[h+1] = (s1 > 0)?1:-1; Amb[i] = false; }
+				else ++nm;
+			}
+		} else {
+			double s0 = 0.0, s1 = 0.0;
+			if (hidx0>0) s0 += Guess[pbwt_arrays.A[hidx0-1]] * scoreBit[l - pbwt_arrays.D[hidx0] + 1];
+			if (hidx0<(n_total_hap-1)) s0 += Guess[pbwt_arrays.A[hidx0+1]] * scoreBit[l - pbwt_arrays.D[hidx0+1] + 1];
+			if (hidx1>0) s1 += Guess[pbwt_arrays.A[hidx1-1]] * scoreBit[l - pbwt_arrays.D[hidx1] + 1];
+			if (hidx1<(n_total_hap-1)) s1 += Guess[pbwt_arrays.A[hidx1+1]] * scoreBit[l - pbwt_arrays.D[hidx1+1] + 1];
+			if (Het[i]) {
+				if (s0 - s1 > 0) { GuessNext[h+0] = 1 ; GuessNext[h+1] = -1 ; }
+				else { GuessNext[h+0] = -1 ; GuessNext[h+1] = 1 ; }
+			} else {
+				GuessNext[h+0] = (s0 > 0)?1:-1;
+				GuessNext[h+1] = (s1 > 0)?1:-1;
+			}
+		}
+	}
+	nh_thread[t] = nh;
+	nm_thread[t] = nm;
 }
 
 /*
@@ -59,110 +177,80 @@ void pbwt_solver::free() {
  * Richard Durbin: Wellcome Sanger Institute, https://www.sanger.ac.uk/people/directory/durbin-richard
  * Original version of the code (MIT license): https://github.com/richarddurbin/pbwt/blob/master/pbwtImpute.c / function "phaseSweep"
  */
-void pbwt_solver::sweep(genotype_set & G) {
+void pbwt_solver::sweep(genotype_set & _G) {
 	tac.clock();
-	vector < int > B = vector < int >(n_total_hap, 0);
-	vector < int > E = vector < int >(n_total_hap, 0);
+	G = &_G;
+	pbwt_arrays.reset();
+	if (n_thread > 1) {
+		for (int t = 0 ; t < n_thread ; t++) pthread_create( &id_workers[t] , NULL, pbwt_solver_callback, static_cast<void *>(this));
+		for (int t = 0 ; t < n_thread ; t++) pthread_join( id_workers[t] , NULL);
+	} else sweep(0);
+	vrb.bullet("PBWT phase sweep (" + stb.str(tac.rel_time()*1.0/1000, 2) + "s)");
+}
 
+/*
+ * Sweep run by thread t. Each thread owns a block of haplotypes aligned on 64 bits (hence whole bytes
+ * of H and whole words of the masks) and resolves the individuals in it; the PBWT update is done by thread 0.
+ */
+void pbwt_solver::sweep(int t) {
+	prepare(t);
+	int h0 = hap_range[t].first, h1 = hap_range[t].second;
+	int i0 = min(h0, (int)n_main_hap) / 2, i1 = min(h1, (int)n_main_hap) / 2;
 	for (int l = 0 ; l < n_site ; l++) {
-		int idx_next = (l%2 == 1);
-		int idx_prev = (l%2 == 0);
 		if (l > 0) {
-			double thresh = 2.5, s, s0, s1;
-			unsigned int nm = 0, nh = 0;
-			for (int h = 0 ; h < n_total_hap ; h++) Guess[h] = (H.get(l, h)?1:-1);
-			for (int i = 0 ; i < n_main_hap/2 ; i ++) {
-				Mis[i] = VAR_GET_MIS(MOD2(l), G.vecG[i]->Variants[DIV2(l)]);
-				Het[i] = VAR_GET_HET(MOD2(l), G.vecG[i]->Variants[DIV2(l)]);
-				Amb[i] = (Het[i] || Mis[i]);
+			for (int h = h0 ; h < h1 ; h += 64) {
+				uint64_t word = H.getWord(l, h / 64);
+				for (int b = 0 ; b < 64 && (h + b) < h1 ; b ++) Guess[h + b] = ((word >> (63 - b)) & 1UL)?1:-1;
+			}
+			unsigned int nh = 0, nm = 0;
+			uint64_t het_word = 0, mis_word = 0;
+			for (int i = i0 ; i < i1 ; i ++) {
+				if (i == i0 || (i % 64) == 0) {
+					het_word = HetMaskVar.getWord(l, i / 64);
+					mis_word = MisMaskVar.getWord(l, i / 64);
+				}
+				Het[i] = (het_word >> (63 - (i % 64))) & 1UL;
+				Mis[i] = (mis_word >> (63 - (i % 64))) & 1UL;
+				Amb[i] = (Het[i] | Mis[i]);
 				if (Amb[i]) { Guess[2*i+0] = 0; Guess[2*i+1] = 0;}
 				nh+=Het[i];
 			}
+			std::copy(Guess.begin() + 2 * i0, Guess.begin() + 2 * i1, GuessNext.begin() + 2 * i0);
+			nh_thread[t] = nh;
+			wait();
+
+			double thresh = 2.5;
+			nh = 0;
+			for (int u = 0 ; u < n_thread ; u ++) nh += nh_thread[u];
+			if (nh) wait();		//Counts are read by all threads before the first vote overwrites them
 			while (nh && thresh > 1.0) {
-				int nhOld = nh; nh = 0, nm = 0 ;
-				for (int i = 0, h = 0 ; i < n_main_hap/2 ; ++i, h += 2) {
-					if (Amb[i]) {
-						if (Het[i]) {
-							unsigned int hidx0 = pbwt_indexes[idx_prev][h+0];
-							unsigned int hidx1 = pbwt_indexes[idx_prev][h+1];
-							s = 0.0;
-							if (hidx0>0) s += Guess[pbwt_clusters[idx_prev][hidx0-1]];
-							if (hidx0<(n_total_hap-1)) s += Guess[pbwt_clusters[idx_prev][hidx0+1]];
-							if (hidx1>0) s -= Guess[pbwt_clusters[idx_prev][hidx1-1]];
-							if (hidx1<(n_total_hap-1)) s -= Guess[pbwt_clusters[idx_prev][hidx1+1]];
-							if (s > thresh) { Guess[h+0] = 1.0; Guess[h+1] = -1.0; Amb[i] = false; }
-							else if (s < -thresh) { Guess[h+0] = -1.0; Guess[h+1] = 1.0; Amb[i] = false; }
-							else ++nh;
-						} else {
-							unsigned int hidx0 = pbwt_indexes[idx_prev][h+0];
-							unsigned int hidx1 = pbwt_indexes[idx_prev][h+1];
-							if (hidx0>0) s0 = Guess[pbwt_clusters[idx_prev][hidx0-1]];
-							if (hidx0<(n_total_hap-1)) s0 += Guess[pbwt_clusters[idx_prev][hidx0+1]];
-							if (hidx1>0) s1 = Guess[pbwt_clusters[idx_prev][hidx1-1]];
-							if (hidx1<(n_total_hap-1)) s1 += Guess[pbwt_clusters[idx_prev][hidx1+1]];
-							if (s0 == -2 && s1 == -2) { Guess[h+0] = -1.0; Guess[h+1] = -1.0; Amb[i] = false; }
-							else if (s0 == -2 && s1 == 2) { Guess[h+0] = -1.0; Guess[h+1] = 1.0; Amb[i] = false; }
-							else if (s0 == 2 && s1 == -2) { Guess[h+0] = 1.0; Guess[h+1] = -1.0; Amb[i] = false; }
-							else if (s0 == 2 && s1 == 2) { Guess[h+0] = 1.0; Guess[h+1] = 1.0; Amb[i] = false; }
-							else ++nm;
-						}
-					}
-				}
+				unsigned int nhOld = nh;
+				vote(t, l, thresh, false);
+				wait();
+				std::copy(GuessNext.begin() + 2 * i0, GuessNext.begin() + 2 * i1, Guess.begin() + 2 * i0);
+				nh = 0; nm = 0;
+				for (int u = 0 ; u < n_thread ; u ++) { nh += nh_thread[u]; nm += nm_thread[u]; }
+				wait();
 				if (nh == nhOld) thresh -= 1.0 ;
 			}
 			if (nh || nm) {
-				for (int i = 0, h = 0 ; i < n_main_hap/2 ; ++i, h += 2) {
-					if (Amb[i]) {
-						if (Het[i]) {
-							unsigned int hidx0 = pbwt_indexes[idx_prev][h+0];
-							unsigned int hidx1 = pbwt_indexes[idx_prev][h+1];
-							s = 0.0;
-							if (hidx0>0) s += Guess[pbwt_clusters[idx_prev][hidx0-1]] * scoreBit[l - pbwt_divergences[idx_prev][hidx0] + 1];
-							if (hidx0<(n_total_hap-1)) s += Guess[pbwt_clusters[idx_prev][hidx0+1]] * scoreBit[l - pbwt_divergences[idx_prev][hidx0+1]+1];
-							if (hidx1>0) s -= Guess[pbwt_clusters[idx_prev][hidx1-1]] * scoreBit[l - pbwt_divergences[idx_prev][hidx1] + 1];
-							if (hidx1<(n_total_hap-1)) s -= Guess[pbwt_clusters[idx_prev][hidx1+1]] * scoreBit[l - pbwt_divergences[idx_prev][hidx1+1] + 1];
-							if (s > 0) { Guess[h+0] = 1 ; Guess[h+1] = -1 ; }
-							else { Guess[h+0] = -1 ; Guess[h+1] = 1 ; }
-						}  else {
-							unsigned int hidx0 = pbwt_indexes[idx_prev][h+0];
-							unsigned int hidx1 = pbwt_indexes[idx_prev][h+1];
-							if (hidx0>0) s0 = Guess[pbwt_clusters[idx_prev][hidx0-1]] * scoreBit[l - pbwt_divergences[idx_prev][hidx0] + 1];
-							if (hidx0<(n_total_hap-1)) s0 += Guess[pbwt_clusters[idx_prev][hidx0+1]] * scoreBit[l - pbwt_divergences[idx_prev][hidx0+1]+1];
-							if (hidx1>0) s1 = Guess[pbwt_clusters[idx_prev][hidx1-1]] * scoreBit[l - pbwt_divergences[idx_prev][hidx1] + 1];
-							if (hidx1<(n_total_hap-1)) s1 += Guess[pbwt_clusters[idx_prev][hidx1+1]] * scoreBit[l - pbwt_divergences[idx_prev][hidx1+1] + 1];
-							if (s0 > 0) Guess[h+0] = 1.0;
-							else Guess[h+0] = -1.0;
-							if (s1 > 0) Guess[h+1] = 1.0;
-							else Guess[h+1] = -1.0;
-						}
-					}
-				}
+				vote(t, l, 0.0, true);
+				wait();
+				std::copy(GuessNext.begin() + 2 * i0, GuessNext.begin() + 2 * i1, Guess.begin() + 2 * i0);
 			}
-			for (int h = 0 ; h < n_main_hap ; h++) if (Het[h/2] || Mis[h/2]) H.set(l, h, Guess[h] > 0);
+			for (int i = i0 ; i < i1 ; i ++) if (Het[i] || Mis[i]) {
+				H.set(l, 2*i+0, Guess[2*i+0] > 0);
+				H.set(l, 2*i+1, Guess[2*i+1] > 0);
+			}
+			wait();
 		}
 
-		int u = 0, v = 0, p = l, q = l;
-		for (int h = 0 ; h < n_total_hap ; h ++) {
-			int alookup = (l>0)?pbwt_clusters[idx_prev][h]:h;
-			int dlookup = (l>0)?pbwt_divergences[idx_prev][h]:0;
-			if (dlookup > p) p = dlookup;
-			if (dlookup > q) q = dlookup;
-			if (!H.get(l, alookup)) {
-				pbwt_clusters[idx_next][u] = alookup;
-				pbwt_divergences[idx_next][u] = p;
-				p = 0;
-				u++;
-			} else {
-				B[v] = alookup;
-				E[v] = q;
-				q = 0;
-				v++;
-			}
+		if (t == 0) {
+			H.unpack(l, n_total_hap, Hrow.data());
+			pbwt_arrays.update < 2 > (Hrow.data(), l);
+			vrb.progress("  * PBWT phase sweep", (l+1)*1.0/n_site);
 		}
-		copy(B.begin(), B.begin()+v,pbwt_clusters[idx_next].begin()+u);
-		copy(E.begin(), E.begin()+v,pbwt_divergences[idx_next].begin()+u);
-		for (int h = 0 ; h < n_total_hap ; h ++) pbwt_indexes[idx_next][pbwt_clusters[idx_next][h]] = h;
-		vrb.progress("  * PBWT phase sweep", (l+1)*1.0/n_site);
+		wait();
+		for (int h = h0 ; h < h1 ; h ++) pbwt_indexes[pbwt_arrays.A[h]] = h;
 	}
-	vrb.bullet("PBWT phase sweep (" + stb.str(tac.rel_time()*1.0/1000, 2) + "s)");
 }
@@ -29,17 +29,38 @@ class pbwt_solver {
 private:
 	bitmatrix & H;
 	unsigned int n_site, n_main_hap, n_ref_hap, n_total_hap, n_total, n_resolved;
-	vector < vector < int > > pbwt_clusters, pbwt_indexes, pbwt_divergences;
-	vector < char > Guess;
-	vector < bool > Het, Mis, Amb;
+	pbwt_kernel pbwt_arrays;
+	vector < int > pbwt_indexes;
+	vector < unsigned char > Hrow;
+	vector < char > Guess, GuessNext;
+	vector < unsigned char > Het, Mis, Amb;
 	vector < float > scoreBit;
+	bitmatrix HetMask, MisMask;			//Het and Mis status of each genotype (individual first)
+	bitmatrix HetMaskVar, MisMaskVar;	//Het and Mis status of each genotype (variant first)
+
+	//Per thread counts of unresolved hets and missing genotypes at the current site
+	vector < unsigned int > nh_thread, nm_thread;
+
+	void wait();
+	void prepare(int);
+	void vote(int, int, double, bool);
 
 public:
+	//MULTI-THREADING
+	int i_workers;
+	int n_thread;
+	pthread_mutex_t mutex_workers;
+	pthread_barrier_t barrier_workers;
+	vector < pthread_t > id_workers;
+	vector < pair < int, int > > hap_range;	//Block of haplotypes processed by each thread, aligned on 64 bits
+	genotype_set * G;
+
 	pbwt_solver(haplotype_set &);
 	~pbwt_solver();
 	void free();
 
 	void sweep(genotype_set &);
+	void sweep(int);
 };
 
 #endif
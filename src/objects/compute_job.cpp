@@ -51,6 +51,8 @@ bool compute_job::reccursive_window_splitting(double min_length_cm, int left_ind
 
 compute_job::compute_job(variant_map & _V, genotype_set & _G, haplotype_set & _H, unsigned int n_max_transitions) : V(_V), G(_G), H(_H) {
 	T = vector < double > (n_max_transitions, 0.0);
+	numa_node = 0;
+	numa_local = false;
 }
 
 compute_job::~compute_job() {
@@ -61,6 +63,8 @@ void compute_job::free () {
 	vector < double > ().swap(T);
 	vector < coordinates > ().swap(C);
 	vector < vector < unsigned int > > ().swap(Kvec);
+	Hwin_hap.free();
+	Hwin_var.free();
 }
 
 void compute_job::reset() {
@@ -68,6 +72,15 @@ void compute_job::reset() {
 	Kvec.clear();
 }
 
+//Called by a pinned worker: reallocates the buffers so that they are first touched on the node of the worker
+void compute_job::localise(int node) {
+	numa_node = node;
+	if (numa_local) return;
+	vector < double > (T.begin(), T.end()).swap(T);
+	S = genotype_scratch ();
+	numa_local = true;
+}
+
 void compute_job::make(unsigned int ind, double min_window_size) {
 	//1. Mapping coordinates of each segment
 	vector < unsigned int > loc_idx = vector < unsigned int >(G.vecG[ind]->n_segments, 0);
@@ -138,43 +151,29 @@ void compute_job::make(unsigned int ind, double min_window_size) {
 	//cout << "Done coordinates"<< endl;
 
 	//4. Update conditional haps
-	unsigned long addr_offset = H.pbwt_nstored * H.n_ind * 2UL;
 	Kvec = vector < vector < unsigned int > > (n_windows);
 	vector < int > phap = vector < int > (2 * H.pbwt_depth, -1);
+	vector < int > chap = vector < int > (2 * H.pbwt_depth, -1);
+	const huge_vector < PBWTrun > & runs0 = H.pbwt_neighbours[2*ind+0];
+	const huge_vector < PBWTrun > & runs1 = H.pbwt_neighbours[2*ind+1];
+	unsigned int r0 = 0, r1 = 0;
 	for (int l = 0, w = 0 ; l < H.pbwt_evaluated.size() ; l ++) {
 		int abs_idx = H.pbwt_evaluated[l], rel_idx = H.pbwt_stored[l];
 		if (abs_idx > C[w].stop_locus) { std::fill(phap.begin(), phap.end(), -1); w++; }
 		if (rel_idx >= 0) {
-			unsigned long curr_hap0 = 2*ind+0, curr_hap1 = 2*ind+1;
+			unsigned int next_idx = (rel_idx + 1) * H.pbwt_depth;
+			for (; r0 < runs0.size() && runs0[r0].idx < next_idx ; r0 ++) chap[2*(runs0[r0].idx % H.pbwt_depth)+0] = runs0[r0].hap;
+			for (; r1 < runs1.size() && runs1[r1].idx < next_idx ; r1 ++) chap[2*(runs1[r1].idx % H.pbwt_depth)+1] = runs1[r1].hap;
 			bool addToNext = ((w+1)<n_windows && abs_idx>=C[w+1].start_locus);
 			for (int s = 0 ; s < H.pbwt_depth ; s ++) {
-				int cond_hap0 = H.pbwt_neighbours[s * addr_offset + curr_hap0*H.pbwt_nstored + rel_idx];
-				int cond_hap1 = H.pbwt_neighbours[s * addr_offset + curr_hap1*H.pbwt_nstored + rel_idx];
+				int cond_hap0 = chap[2*s+0];
+				int cond_hap1 = chap[2*s+1];
 				if (cond_hap0 != phap[2*s+0]) { Kvec[w].push_back(cond_hap0); phap[2*s+0] = cond_hap0; };
 				if (cond_hap1 != phap[2*s+1]) { Kvec[w].push_back(cond_hap1); phap[2*s+1] = cond_hap1; };
 				if (addToNext) { Kvec[w+1].push_back(cond_hap0); Kvec[w+1].push_back(cond_hap1); }
 			}
 		}
 	}
-	/*
-	unsigned long block_size = H.pbwt_nstored * H.n_ind * 2UL;
-	Kvec = vector < vector < unsigned int > > (n_windows);
-	for (int d = 0 ; d < H.pbwt_depth ; d ++) {
-		for (int h = 0; h < 2; h++) {
-			unsigned long curr_hap = 2*ind+h;
-			for (int l = 0, w = 0 ; l < H.pbwt_evaluated.size() ; l ++) {
-				int abs_idx = H.pbwt_evaluated[l];
-				int rel_idx = H.pbwt_stored[l];
-				if (abs_idx > C[w].stop_locus) w++;
-				if (rel_idx>=0) {
-					int curr_cond_hap = H.pbwt_neighbours[d * block_size + curr_hap*H.pbwt_nstored + rel_idx];
-					if (Kvec[w].empty() || curr_cond_hap != Kvec[w].back()) Kvec[w].push_back(curr_cond_hap);
-					if ((w+1)<n_windows && abs_idx>=C[w+1].start_locus && (Kvec[w+1].empty() || curr_cond_hap != Kvec[w+1].back())) Kvec[w+1].push_back(curr_cond_hap);
-				}
-			}
-		}
-	}
-	*/
 	for (int w = 0 ; w < n_windows; w++) {
 		sort(Kvec[w].begin(), Kvec[w].end());
 		Kvec[w].erase(unique(Kvec[w].begin(), Kvec[w].end()), Kvec[w].end());
@@ -183,8 +182,22 @@ void compute_job::make(unsigned int ind, double min_window_size) {
 	//cout << "Done selection"<< endl;
 }
 
+//Copies the conditioning haplotypes of window w into Hwin_var, one row of K bits per locus, so that the HMM reads them sequentially
+void compute_job::gather(bitmatrix & H, unsigned int w) {
+	unsigned int n_cond = Kvec[w].size(), n_loci = C[w].stop_locus - C[w].start_locus + 1;
+	if (Hwin_hap.n_rows < n_cond || Hwin_hap.n_cols < n_loci) {
+		unsigned int max_cond = max(n_cond, (unsigned int)Hwin_hap.n_rows), max_loci = max(n_loci, (unsigned int)Hwin_hap.n_cols);
+		Hwin_hap.free();
+		Hwin_var.free();
+		Hwin_hap.allocate(max_cond, max_loci);
+		Hwin_var.allocate(max_loci, max_cond);
+	}
+	Hwin_hap.gather(H, Kvec[w], C[w].start_locus, n_loci);
+	Hwin_hap.transpose(Hwin_var, n_cond, n_loci);
+}
+
 void compute_job::maskingTransitions(unsigned int ind, double error_rate) {
-	vector < double > curr_transitions = vector < double > (4096, 0.0);
+	double * curr_transitions = S.Probs.data();
 	unsigned int prev_dipcount = 1, curr_dipcount = 0, curr_transcount = 0;
 	for (unsigned int s = 0, t = 0 ; s < G.vecG[ind]->n_segments ; s ++) {
 		curr_dipcount = G.vecG[ind]->countDiplotypes(G.vecG[ind]->Diplotypes[s]);
@@ -70,13 +70,20 @@ public:
 	vector < double > T;
 	vector < coordinates > C;
 	vector < vector < unsigned int > > Kvec;
+	genotype_scratch S;
+	bitmatrix Hwin_hap;		//Conditioning haplotypes of the current window (haplotype first)
+	bitmatrix Hwin_var;		//Same, transposed (locus first), as read by the HMM
+	int numa_node;
+	bool numa_local;
 
 	compute_job(variant_map & , genotype_set & , haplotype_set & , unsigned int n_max_transitions);
 	~compute_job();
 
 	void free();
 	void reset();
+	void localise(int);
 	void make(unsigned int, double);
+	void gather(bitmatrix &, unsigned int);
 	unsigned int size();
 	void maskingTransitions(unsigned int, double);
 	bool reccursive_window_splitting(double, int, int, vector < int > &, vector < int > &, vector < double > &, vector < double > &, vector < int > &);
@@ -40,7 +40,7 @@
 
 #include <objects/genotype/genotype_header.h>
 
-void genotype::build() {
+void genotype::count() {
 	//1. Count number of segments
 	unsigned n_unf = 0, n_var = 0, n_sca = 0, n_seg = 0, n_amb = 0;
 	for (unsigned int v = 0 ; v < n_variants ;) {
@@ -64,10 +64,12 @@ void genotype::build() {
 	}
 	n_segments = n_seg + 1;
 	n_ambiguous = n_amb;
+}
 
+//Lengths, Ambiguous and Diplotypes must point to zeroed slices sized by count()
+void genotype::build() {
 	//2. Build Segments
-	n_unf = 0, n_var = 0, n_sca = 0, n_seg = 0, n_amb = 0;
-	Lengths = vector < unsigned short > (n_segments, 0U);
+	unsigned n_unf = 0, n_var = 0, n_sca = 0, n_seg = 0, n_amb = 0;
 	for (unsigned int v = 0 ; v < n_variants ;) {
 		bool f_sca = VAR_GET_SCA(MOD2(v),Variants[DIV2(v)]);
 		bool f_het = VAR_GET_HET(MOD2(v),Variants[DIV2(v)]);
@@ -91,7 +93,6 @@ void genotype::build() {
 	Lengths[n_seg] = n_var;
 
 	//3. Build Ambiguous
-	Ambiguous = vector < unsigned char >(n_ambiguous, 0U);
 	vector < unsigned char > orderedSegments = vector < unsigned char >(n_segments, 0);
 	for (unsigned int s = 0, a0 = 0, a1 = 0, a2 = 0, vabs = 0 ; s < n_segments ; s ++) {
 		for (unsigned int vrel = 0 ; vrel < Lengths[s] ; vrel ++) {
@@ -125,7 +126,6 @@ void genotype::build() {
 	}
 
 	//4. Build Diplotypes
-	Diplotypes = vector < unsigned long > (n_segments);
 	for (unsigned int s = 0, vabs = 0, a = 0 ; s < n_segments ; s ++) {
 		unsigned int n_unf = orderedSegments[s];
 		Diplotypes[s]=n_unf?MASK_SCAF:MASK_INIT;
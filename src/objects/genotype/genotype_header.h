@@ -56,6 +56,45 @@
 #define VAR_CLR_HAP1(e,v)	((e)?((v)&=127):((v)&=247))
 
 #define PS_ALLOC_CHUNK	32
+#define MAX_TRANS	4096
+
+class Transition {
+public:
+	double prob;
+	unsigned int idx;
+	Transition() { prob = 0.0; idx = 0;}
+	~Transition() {}
+	bool operator < (const Transition & t) const { return prob > t.prob; }
+};
+
+class TransStatistics {
+public:
+	double entropy;
+	unsigned int idx;
+	bool merged;
+	TransStatistics() {entropy = 1000; idx = -1; merged = false; }
+	~TransStatistics() {};
+	bool operator < (const TransStatistics & s) const { return entropy < s.entropy; }
+};
+
+//Scratch space reused across the genotype graphs processed by a thread (sampling, pruning, masking)
+class genotype_scratch {
+public:
+	vector < double > Probs;					// Transition probabilities of the current segment(s)
+	vector < unsigned char > DipSampled;		// Sampled diplotype per segment
+	vector < Transition > Transitions;			// Transitions of the current segment, ordered on demand
+	vector < TransStatistics > Statistics;		// Merge statistics per pair of adjacent segments
+	vector < bool > flagMerges;					// Segments to be merged with the previous one
+	vector < unsigned char > Ambiguous;			// Ambiguous, Diplotypes and Lengths of the pruned graph
+	vector < unsigned long > Diplotypes;
+	vector < unsigned short > Lengths;
+	vector < unsigned char > Variants;			// Haplotypes sampled at the previous iteration, to count phase changes
+
+	genotype_scratch() {
+		Probs = vector < double > (MAX_TRANS, 0.0);
+		Transitions = vector < Transition > (MAX_TRANS);
+	}
+};
 
 struct phase_set {
 	unsigned int ps : 30;
@@ -80,11 +119,11 @@ public:
 	unsigned int n_masks;				// Number of masked transitions (either 0 or n_transitions)
 	unsigned char curr_dipcodes [64];	// List of diplotypes in a given segment
 
-	// VARIANT / HAPLOTYPE / DIPLOTYPE DATA
-	vector < unsigned char > Variants;		// 0.5 byte per variant
-	vector < unsigned char > Ambiguous;		// 1 byte per ambiguous variant
-	vector < unsigned long > Diplotypes;	// 8 bytes per segment
-	vector < unsigned short > Lengths;		// 2 bytes per segment
+	// VARIANT / HAPLOTYPE / DIPLOTYPE DATA (slices of the cohort-wide arenas of genotype_set)
+	unsigned char * Variants;			// 0.5 byte per variant
+	unsigned char * Ambiguous;			// 1 byte per ambiguous variant
+	unsigned long * Diplotypes;			// 8 bytes per segment
+	unsigned short * Lengths;			// 2 bytes per segment
 
 	//PHASE PROBS
 	vector < bool > ProbMask;
@@ -100,15 +139,17 @@ public:
 	~genotype();
 	void free();
 	void make(vector < unsigned char > &);
+	void count();
 	void build();
-	void sample(vector < double > &);
-	void sampleForward(vector < double > &);
-	void sampleBackward(vector < double > &);
-	void solve();
-	void mapMerges(vector < double > &, double , vector < bool > &);
-	void performMerges(vector < double > &, vector < bool > &);
+	void sample(vector < double > &, genotype_scratch &);
+	void sampleForward(vector < double > &, genotype_scratch &);
+	void sampleBackward(vector < double > &, genotype_scratch &);
+	void solve(vector < double > &, vector < int > &, vector < unsigned char > &);
+	void mapMerges(vector < double > &, double , genotype_scratch &);
+	void performMerges(vector < double > &, genotype_scratch &);
 	void mask();
 	void store(vector < double > &);
+	unsigned int countSwitches(vector < unsigned char > &, unsigned int &);
 
 	//INLINES
 	unsigned int countDiplotypes(unsigned long);
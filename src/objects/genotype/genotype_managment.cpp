@@ -28,6 +28,10 @@ genotype::genotype(unsigned int _index) {
 	n_ambiguous = 0;
 	std::fill(curr_dipcodes, curr_dipcodes + 64, 0);
 	this->name = "";
+	Variants = NULL;
+	Ambiguous = NULL;
+	Diplotypes = NULL;
+	Lengths = NULL;
 }
 
 genotype::~genotype() {
@@ -37,10 +41,10 @@ genotype::~genotype() {
 void genotype::free() {
 	std::fill(curr_dipcodes, curr_dipcodes + 64, 0);
 	name = "";
-	vector < unsigned char > ().swap(Variants);
-	vector < unsigned char > ().swap(Ambiguous);
-	vector < unsigned long > ().swap(Diplotypes);
-	vector < unsigned short > ().swap(Lengths);
+	Variants = NULL;
+	Ambiguous = NULL;
+	Diplotypes = NULL;
+	Lengths = NULL;
 }
 
 void genotype::make(vector < unsigned char > & DipSampled) {
@@ -23,28 +23,21 @@
 
 #define MAX_AMB	32
 
-class Transition {
-public:
-	double prob;
-	unsigned int idx;
-	Transition() { prob = 0.0; idx = 0;}
-	~Transition() {}
-	bool operator < (const Transition & t) const { return prob > t.prob; }
-};
-
-class TransStatistics {
-public:
-	double entropy;
-	unsigned int idx;
-	bool merged;
-	TransStatistics() {entropy = 1000; idx = -1; merged = false; }
-	~TransStatistics() {};
-	bool operator < (const TransStatistics & s) const { return entropy < s.entropy; }
-};
+/*
+ * Orders Transitions[t, n) by decreasing probability on demand: the next block of at most twice the already
+ * sorted size is partially sorted, so that pruning only pays for the transitions it actually visits.
+ */
+static inline unsigned int sortNextTransitions(vector < Transition > & Transitions, unsigned int t, unsigned int n) {
+	unsigned int n_next = min(n, max(2 * t, 16U));
+	partial_sort(Transitions.begin() + t, Transitions.begin() + n_next, Transitions.begin() + n);
+	return n_next;
+}
 
-void genotype::mapMerges(vector < double > & currProbs, double thresholdProbMass, vector < bool > & flagMerges) {
-	vector < TransStatistics > vecTransStatistics = vector < TransStatistics > (n_segments - 1);
-	vector < Transition > vecTransitions = vector < Transition > (4096);
+void genotype::mapMerges(vector < double > & currProbs, double thresholdProbMass, genotype_scratch & S) {
+	if (S.Statistics.size() < n_segments - 1) S.Statistics.resize(n_segments - 1);
+	vector < TransStatistics > & vecTransStatistics = S.Statistics;
+	vector < Transition > & vecTransitions = S.Transitions;
+	int Mhaps [HAP_NUMBER * HAP_NUMBER];
 
 	//Step0: initialize cursors
 	unsigned int prev_dipcount = countDiplotypes(Diplotypes[0]);
@@ -76,23 +69,20 @@ void genotype::mapMerges(vector < double > & currProbs, double thresholdProbMass
 					n_ambiguous_merged++;
 			//Step4: check number of ambiguous variants in merged segment
 			if (n_ambiguous_merged <= MAX_AMB) {
-				//Step5: sort transitions by decreasing order
-				for (int t = 0 ; t < n_curr_transitions ; t ++) {
-					vecTransitions[t].prob = currProbs[toffset + t];
-					vecTransitions[t].idx = t;
-				}
-				sort(vecTransitions.begin(), vecTransitions.begin() + n_curr_transitions);
-				//Step6: compute transition entropy
+				//Step5: compute transition entropy
 				vecTransStatistics[s-1].entropy = 0.0;
 				for (int t = 0 ; t < n_curr_transitions ; t ++) {
-					double cProb = vecTransitions[t].prob;
+					double cProb = currProbs[toffset + t];
 					double lProb = -1.0 * ((cProb==0.0)?0:log10(cProb));
 					vecTransStatistics[s-1].entropy += cProb * lProb;
+					vecTransitions[t].prob = cProb;
+					vecTransitions[t].idx = t;
 				}
-				//Step7: check that 8 haplotypes capture lots of the cumulative probability mass
+				//Step6: check that 8 haplotypes capture lots of the cumulative probability mass, visiting transitions by decreasing order
 				double cumSumProbs = 0.0;
-				vector < int > Mhaps = vector < int >(HAP_NUMBER * HAP_NUMBER, -1);
-				for (int t = 0, n_haps = 0 ; t < n_curr_transitions ; t ++) {
+				std::fill(Mhaps, Mhaps + HAP_NUMBER * HAP_NUMBER, -1);
+				for (int t = 0, n_haps = 0, n_sorted = 0 ; t < n_curr_transitions && n_haps <= HAP_NUMBER ; t ++) {
+					if (t == n_sorted) n_sorted = sortNextTransitions(vecTransitions, t, n_curr_transitions);
 					cumSumProbs += vecTransitions[t].prob;
 					unsigned int prev_dip = prev_dipcodes[vecTransitions[t].idx/curr_dipcount];
 					unsigned int next_dip = curr_dipcodes[vecTransitions[t].idx%curr_dipcount];
@@ -104,11 +94,12 @@ void genotype::mapMerges(vector < double > & currProbs, double thresholdProbMass
 					unsigned int merged_h1 = prev_h1 * HAP_NUMBER + next_h1;
 					bool new_h0 = (Mhaps[merged_h0] < 0);
 					bool new_h1 = ((Mhaps[merged_h1] < 0) && (merged_h0 != merged_h1));
-					//if ((n_haps + new_h0 + new_h1) <= HAP_NUMBER) {
-						if (new_h0) Mhaps[merged_h0] = n_haps++;
-						if (new_h1) Mhaps[merged_h1] = n_haps++;
-					//}
-					if (n_haps == HAP_NUMBER && cumSumProbs > thresholdProbMass) vecTransStatistics[s-1].merged = true;
+					if (new_h0) Mhaps[merged_h0] = n_haps++;
+					if (new_h1) Mhaps[merged_h1] = n_haps++;
+					if (n_haps == HAP_NUMBER && cumSumProbs > thresholdProbMass) {
+						vecTransStatistics[s-1].merged = true;
+						break;
+					}
 				}
 			}
 		}
@@ -120,27 +111,31 @@ void genotype::mapMerges(vector < double > & currProbs, double thresholdProbMass
 		prev_dipcount = curr_dipcount;
 		toffset += n_curr_transitions;
 	}
-	//Step9: map acceptable merges
-	sort(vecTransStatistics.begin(), vecTransStatistics.end());
-	flagMerges = vector < bool > (n_segments+1, false);
-	for (unsigned int s = 0 ; s < vecTransStatistics.size() ; s ++) {
+	//Step7: map acceptable merges
+	sort(vecTransStatistics.begin(), vecTransStatistics.begin() + n_segments - 1);
+	vector < bool > & flagMerges = S.flagMerges;
+	flagMerges.assign(n_segments+1, false);
+	for (unsigned int s = 0 ; s < n_segments - 1 ; s ++) {
 		bool no_adjacent_merges = !flagMerges[vecTransStatistics[s].idx-1] && !flagMerges[vecTransStatistics[s].idx+1];
 		bool can_be_merged = vecTransStatistics[s].merged;
 		flagMerges[vecTransStatistics[s].idx] = (no_adjacent_merges && can_be_merged);
 	}
 }
 
-void genotype::performMerges(vector < double > & currProbs, vector < bool > & flagMerges) {
-	vector < Transition > vecTransitions = vector < Transition > (4096);
+void genotype::performMerges(vector < double > & currProbs, genotype_scratch & S) {
+	vector < bool > & flagMerges = S.flagMerges;
+	vector < Transition > & vecTransitions = S.Transitions;
+	int Mhaps [HAP_NUMBER * HAP_NUMBER];
 
 	//Step0: initialize duplicates
-	vector < unsigned char > Ambiguous2 = vector < unsigned char > (Ambiguous.size(), 0);
-	vector < unsigned long > Diplotypes2;
-	vector < unsigned short > Lengths2;
+	vector < unsigned char > & Ambiguous2 = S.Ambiguous;
+	vector < unsigned long > & Diplotypes2 = S.Diplotypes;
+	vector < unsigned short > & Lengths2 = S.Lengths;
+	Ambiguous2.assign(n_ambiguous, 0);
+	Diplotypes2.clear();
+	Lengths2.clear();
 	unsigned int n_segments2 = n_segments;
 	for (int s = 0 ; s < flagMerges.size() ; s++) n_segments2 -= flagMerges[s];
-	Diplotypes2.reserve(n_segments2);
-	Lengths2.reserve(n_segments2);
 
 	//Step1: initialize cursors
 	unsigned int prev_dipcount = countDiplotypes(Diplotypes[0]);
@@ -164,10 +159,11 @@ void genotype::performMerges(vector < double > & currProbs, vector < bool > & fl
 			Lengths2.push_back(Lengths[s-1]+Lengths[s]);
 			Diplotypes2.push_back(0x0000000000000000UL);
 			for (int t = 0 ; t < n_curr_transitions ; t ++) { vecTransitions[t].prob = currProbs[toffset + t]; vecTransitions[t].idx = t; }
-			sort(vecTransitions.begin(), vecTransitions.begin() + n_curr_transitions);
 			int n_haps = 0;
-			vector < int > Mhaps = vector < int >(HAP_NUMBER * HAP_NUMBER, -1);
-			for (int t = 0 ; t < n_curr_transitions ; t ++) {
+			std::fill(Mhaps, Mhaps + HAP_NUMBER * HAP_NUMBER, -1);
+			for (int t = 0, n_sorted = 0 ; t < n_curr_transitions ; t ++) {
+				//Once the 8 merged haplotypes are known, the order of the remaining transitions does not matter
+				if (t == n_sorted && n_haps < HAP_NUMBER) n_sorted = sortNextTransitions(vecTransitions, t, n_curr_transitions);
 				unsigned int prev_dip = prev_dipcodes[vecTransitions[t].idx/curr_dipcount];
 				unsigned int next_dip = curr_dipcodes[vecTransitions[t].idx%curr_dipcount];
 				unsigned int prev_h0 = DIP_HAP0(prev_dip);
@@ -224,20 +220,20 @@ void genotype::performMerges(vector < double > & currProbs, vector < bool > & fl
 		toffset += n_curr_transitions;
 	}
 	if (!flagMerges[flagMerges.size()-2]) {
-		for (unsigned int vrel = 0, arel = 0 ; vrel < Lengths.back() ; vrel ++) {
+		for (unsigned int vrel = 0, arel = 0 ; vrel < Lengths[n_segments - 1] ; vrel ++) {
 			if (VAR_GET_AMB(MOD2(voffset+vrel), Variants[DIV2(voffset+vrel)])) {
 				Ambiguous2[aoffset+arel] = Ambiguous[aoffset+arel];
 				arel ++;
 			}
 		}
-		Lengths2.push_back(Lengths.back());
-		Diplotypes2.push_back(Diplotypes.back());
+		Lengths2.push_back(Lengths[n_segments - 1]);
+		Diplotypes2.push_back(Diplotypes[n_segments - 1]);
 	}
 
-	//free();
-	Ambiguous = Ambiguous2;
-	Diplotypes = Diplotypes2;
-	Lengths = Lengths2;
+	//Merged graph is written back in place, genotype_set::compact releases the tail of the slices
+	std::copy(Ambiguous2.begin(), Ambiguous2.end(), Ambiguous);
+	std::copy(Diplotypes2.begin(), Diplotypes2.end(), Diplotypes);
+	std::copy(Lengths2.begin(), Lengths2.end(), Lengths);
 	n_segments = n_segments2;
 	n_transitions = countTransitions();
 }
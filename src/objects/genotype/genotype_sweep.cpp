@@ -21,38 +21,39 @@
 ////////////////////////////////////////////////////////////////////////////////
 #include <objects/genotype/genotype_header.h>
 
-void genotype::sample(vector < double > & CurrentTransProbabilities) {
-	if (rng.getDouble() < 0.5) sampleForward(CurrentTransProbabilities);
-	else sampleBackward(CurrentTransProbabilities);
+void genotype::sample(vector < double > & CurrentTransProbabilities, genotype_scratch & S) {
+	if (rng.getDouble() < 0.5) sampleForward(CurrentTransProbabilities, S);
+	else sampleBackward(CurrentTransProbabilities, S);
 }
 
-void genotype::sampleForward(vector < double > & CurrentTransProbabilities) {
+void genotype::sampleForward(vector < double > & CurrentTransProbabilities, genotype_scratch & S) {
 	double sumProbs = 0.0;
 	unsigned int prev_sampled = 0;
 	unsigned int curr_dipcount = 0, prev_dipcount = 1;
-	vector < double > currProbs = vector < double > (64, 0.0);
-	vector < unsigned char > DipSampled = vector < unsigned char >(n_segments, 0);
+	double * currProbs = S.Probs.data();
+	if (S.DipSampled.size() < n_segments) S.DipSampled.resize(n_segments);
 	for (unsigned int s = 0, toffset = 0 ; s < n_segments ; s ++) {
 		sumProbs = 0.0;
 		curr_dipcount = countDiplotypes(Diplotypes[s]);
 		for (unsigned int tabs = toffset + prev_sampled*curr_dipcount, trel = 0 ; trel < curr_dipcount ; ++trel, ++tabs)
 			sumProbs += (currProbs[trel] = CurrentTransProbabilities[tabs]);
-		prev_sampled = rng.sample(currProbs, sumProbs);
+		prev_sampled = rng.sample(currProbs, curr_dipcount, sumProbs);
 		makeDiplotypes(Diplotypes[s]);
-		DipSampled[s] = curr_dipcodes[prev_sampled];
+		S.DipSampled[s] = curr_dipcodes[prev_sampled];
 		toffset += prev_dipcount * curr_dipcount;
 		prev_dipcount = curr_dipcount;
 	}
-	make(DipSampled);
+	make(S.DipSampled);
 }
 
-void genotype::sampleBackward(vector < double > & CurrentTransProbabilities) {
+void genotype::sampleBackward(vector < double > & CurrentTransProbabilities, genotype_scratch & S) {
 
 	double sumProbs = 0.0;
 	int next_sampled = -1;
 	unsigned int curr_dipcount = 0, next_dipcount = countDiplotypes(Diplotypes[n_segments - 1]);
-	vector < double > currProbs = vector < double > (64 * 64, 0.0);
-	vector < unsigned char > DipSampled = vector < unsigned char >(n_segments, 0);
+	double * currProbs = S.Probs.data();
+	if (S.DipSampled.size() < n_segments) S.DipSampled.resize(n_segments);
+	S.DipSampled[n_segments - 1] = 0;
 
 	for (int s = n_segments - 2, toffset = n_transitions ; s >= 0 ; s --) {
 		sumProbs = 0.0;
@@ -60,59 +61,68 @@ void genotype::sampleBackward(vector < double > & CurrentTransProbabilities) {
 		toffset -= next_dipcount * curr_dipcount;
 
 		if (next_sampled >= 0) {
-			currProbs.resize(64);
 			for (unsigned int tabs = toffset+next_sampled, trel = 0 ; trel < curr_dipcount ; ++trel, tabs += next_dipcount)
 				sumProbs += (currProbs[trel] = CurrentTransProbabilities[tabs]);
-			next_sampled = rng.sample(currProbs, sumProbs);
+			next_sampled = rng.sample(currProbs, curr_dipcount, sumProbs);
 			makeDiplotypes(Diplotypes[s]);
-			DipSampled[s] = curr_dipcodes[next_sampled];
+			S.DipSampled[s] = curr_dipcodes[next_sampled];
 		} else {
-			for (unsigned int tabs = toffset, trel = 0 ; tabs < n_transitions ; ++trel, ++tabs)
+			unsigned int trel = 0;
+			for (unsigned int tabs = toffset ; tabs < n_transitions ; ++trel, ++tabs)
 				sumProbs += (currProbs[trel] = CurrentTransProbabilities[tabs]);
-			next_sampled = rng.sample(currProbs, sumProbs);
+			next_sampled = rng.sample(currProbs, trel, sumProbs);
 			makeDiplotypes(Diplotypes[s+1]);
-			DipSampled[s+1] = curr_dipcodes[next_sampled % next_dipcount];
+			S.DipSampled[s+1] = curr_dipcodes[next_sampled % next_dipcount];
 			makeDiplotypes(Diplotypes[s]);
 			next_sampled = next_sampled / next_dipcount;
-			DipSampled[s] = curr_dipcodes[next_sampled];
+			S.DipSampled[s] = curr_dipcodes[next_sampled];
 		}
 		next_dipcount = curr_dipcount;
 	}
-	make(DipSampled);
+	make(S.DipSampled);
 }
 
-void genotype::solve() {
-	unsigned int curr_dipcount = 0, prev_dipcount = 1;
-	vector < vector < double > > maxProbs = vector < vector < double > > (n_segments, vector < double > ());
-	vector < vector < int > > maxIndexes = vector < vector < int > > (n_segments, vector < int > ());
+/*
+ * Viterbi pass over the stored transition probabilities. The per-segment maxima are laid out flat
+ * in maxProbs/maxIndexes (segment s starts at the sum of the diplotype counts of segments 0..s-1);
+ * buffers are provided by the caller and only grown when too small.
+ */
+void genotype::solve(vector < double > & maxProbs, vector < int > & maxIndexes, vector < unsigned char > & DipSampled) {
+	unsigned int curr_dipcount = 0, prev_dipcount = 1, n_dip = 0;
+	for (int s = 0 ; s < n_segments ; s ++) n_dip += countDiplotypes(Diplotypes[s]);
+	if (maxProbs.size() < n_dip) maxProbs.resize(n_dip);
+	if (maxIndexes.size() < n_dip) maxIndexes.resize(n_dip);
+	if (DipSampled.size() < n_segments) DipSampled.resize(n_segments);
 
-	for (int s = 0, toffset = 0, trel = 0 ; s < n_segments ; s ++) {
+	for (int s = 0, toffset = 0, trel = 0, doffset = 0, poffset = 0 ; s < n_segments ; s ++) {
 		curr_dipcount = countDiplotypes(Diplotypes[s]);
-		maxProbs[s] = vector < double > (curr_dipcount, 0.0);
-		maxIndexes[s] = vector < int > (curr_dipcount, 0);
+		std::fill(maxProbs.begin() + doffset, maxProbs.begin() + doffset + curr_dipcount, 0.0);
+		std::fill(maxIndexes.begin() + doffset, maxIndexes.begin() + doffset + curr_dipcount, 0);
 		for (int t = 0 ; t < prev_dipcount * curr_dipcount ; t++) {
 			int prev_dip = t/curr_dipcount;
 			int next_dip = t%curr_dipcount;
-			//double currProb = (s?maxProbs[s-1][prev_dip]:1.0) * StoredProbs[t+toffset];
-			double currProb = (s?maxProbs[s-1][prev_dip]:1.0) * (ProbMask[t+toffset]?ProbStored[trel++]:5e-7);
-			if (currProb > maxProbs[s][next_dip]) {
-				maxProbs[s][next_dip] = currProb;
-				maxIndexes[s][next_dip] = prev_dip;
+			double currProb = (s?maxProbs[poffset + prev_dip]:1.0) * (ProbMask[t+toffset]?ProbStored[trel++]:5e-7);
+			if (currProb > maxProbs[doffset + next_dip]) {
+				maxProbs[doffset + next_dip] = currProb;
+				maxIndexes[doffset + next_dip] = prev_dip;
 			}
 		}
 		double sumProb = 0.0;
-		for (int d = 0 ; d < curr_dipcount ; d ++) sumProb += maxProbs[s][d];
-		for (int d = 0 ; d < curr_dipcount ; d ++) maxProbs[s][d] /= sumProb;
+		for (int d = 0 ; d < curr_dipcount ; d ++) sumProb += maxProbs[doffset + d];
+		for (int d = 0 ; d < curr_dipcount ; d ++) maxProbs[doffset + d] /= sumProb;
 		toffset += prev_dipcount * curr_dipcount;
 		prev_dipcount = curr_dipcount;
+		poffset = doffset;
+		doffset += curr_dipcount;
 	}
 
-	vector < unsigned char > DipSampled = vector < unsigned char >(n_segments, 0);
-	unsigned int bestDip = alg.imax(maxProbs.back());
-	makeDiplotypes(Diplotypes.back());
-	DipSampled.back() = curr_dipcodes[bestDip];
-	for (int s = DipSampled.size() - 2 ; s >= 0 ; s --) {
-		bestDip = maxIndexes[s+1][bestDip];
+	unsigned int bestDip = 0, doffset = n_dip - prev_dipcount;
+	for (unsigned int d = 1 ; d < prev_dipcount ; d ++) if (maxProbs[doffset + d] > maxProbs[doffset + bestDip]) bestDip = d;
+	makeDiplotypes(Diplotypes[n_segments - 1]);
+	DipSampled[n_segments - 1] = curr_dipcodes[bestDip];
+	for (int s = n_segments - 2 ; s >= 0 ; s --) {
+		bestDip = maxIndexes[doffset + bestDip];
+		doffset -= countDiplotypes(Diplotypes[s]);
 		makeDiplotypes(Diplotypes[s]);
 		DipSampled[s] = curr_dipcodes[bestDip];
 	}
@@ -132,6 +142,21 @@ void genotype::store(vector < double > & CurrentTransProbabilities) {
 	for (unsigned int t = 0, trel = 0 ; t < n_transitions ; t ++) if (ProbMask[t]) ProbStored[trel++] += CurrentTransProbabilities[t];
 }
 
+//Switches between the haplotypes given (previous sample, same layout as Variants) and the current ones, over the n_hets hets
+unsigned int genotype::countSwitches(vector < unsigned char > & PrevVariants, unsigned int & n_hets) {
+	unsigned int n_switches = 0;
+	int prev_flip = -1;
+	n_hets = 0;
+	for (unsigned int v = 0 ; v < n_variants ; v ++) {
+		if (!VAR_GET_HET(MOD2(v), Variants[DIV2(v)])) continue;
+		int flip = (VAR_GET_HAP0(MOD2(v), Variants[DIV2(v)]) != VAR_GET_HAP0(MOD2(v), PrevVariants[DIV2(v)]));
+		n_switches += (prev_flip >= 0 && flip != prev_flip);
+		prev_flip = flip;
+		n_hets ++;
+	}
+	return n_switches;
+}
+
 /*
 void genotype::store(vector < double > & CurrentTransProbabilities) {
 	if (StoredProbs.size() == 0) StoredProbs = vector < float > (n_transitions, 0.0);
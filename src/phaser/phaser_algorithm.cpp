@@ -22,6 +22,7 @@
 #include <phaser/phaser_header.h>
 
 #include <io/haplotype_writer.h>
+#include <io/checkpoint_writer.h>
 
 void * phaseWindow_callback(void * ptr) {
 	phaser * S = static_cast< phaser * >( ptr );
@@ -29,45 +30,83 @@ void * phaseWindow_callback(void * ptr) {
 	pthread_mutex_lock(&S->mutex_workers);
 	id_worker = S->i_workers ++;
 	pthread_mutex_unlock(&S->mutex_workers);
+#ifdef HMM_COUNTERS
+	S->openCounters();
+#endif
+	if (S->numa.active()) {
+		int n_thread = S->options["thread"].as < int > ();
+		S->numa.pin(id_worker, n_thread);
+		S->threadData[id_worker].localise(S->numa.node(id_worker, n_thread));
+	}
 	for(;;) {
 		pthread_mutex_lock(&S->mutex_workers);
 		id_job = S->i_jobs ++;
 		if (id_job <= S->G.n_ind) vrb.progress("  * HMM computations", id_job*1.0/S->G.n_ind);
 		pthread_mutex_unlock(&S->mutex_workers);
 		if (id_job < S->G.n_ind) S->phaseWindow(id_worker, id_job);
-		else pthread_exit(NULL);
+		else {
+			if (S->report.active()) S->cpu_thread[id_worker] = thread_cpu_time();
+#ifdef HMM_COUNTERS
+			pthread_mutex_lock(&S->mutex_workers);
+			S->closeCounters();
+			pthread_mutex_unlock(&S->mutex_workers);
+#endif
+			pthread_exit(NULL);
+		}
 	}
 }
 
 void phaser::phaseWindow(int id_worker, int id_job) {
+	if (frozen[id_job]) return;
+	double t0 = report.active()?thread_cpu_time():0.0;
+	int64_t s0 = trace.active()?trace.now():0;
 	threadData[id_worker].make(id_job, options["window"].as < double > ());
 	for (int w = 0 ; w < threadData[id_worker].size() ; w ++) {
+		int64_t sw = trace.active()?trace.now():0;
 		if (options["thread"].as < int > () > 1) pthread_mutex_lock(&mutex_workers);
 		statH.push(threadData[id_worker].Kvec[w].size()*1.0);
 		statS.push((V.vec_pos[threadData[id_worker].C[w].stop_locus]->bp - V.vec_pos[threadData[id_worker].C[w].start_locus]->bp + 1) * 1.0 / 1e6);
 		if (options["thread"].as < int > () > 1) pthread_mutex_unlock(&mutex_workers);
 		assert(threadData[id_worker].Kvec[w].size()>0);
 
-		haplotype_segment HS(G.vecG[id_job], H.H_opt_hap, threadData[id_worker].Kvec[w], threadData[id_worker].C[w], M);
+		bitmatrix & Hhap = (numa.mode == NUMA_REPLICATE)?H.H_opt_hap_numa[threadData[id_worker].numa_node]:H.H_opt_hap;
+		for (int k = 0 ; k < threadData[id_worker].Kvec[w].size() ; k ++) Hhap.prefetch(threadData[id_worker].Kvec[w][k], threadData[id_worker].C[w].start_locus, threadData[id_worker].C[w].stop_locus + 1);
+		threadData[id_worker].gather(Hhap, w);
+		haplotype_segment HS(G.vecG[id_job], threadData[id_worker].Hwin_var, threadData[id_worker].Kvec[w], threadData[id_worker].C[w], M);
 		int outcome = HS.expectation(threadData[id_worker].T);
 		if (outcome < 0) vrb.error("Underflow impossible to recover");
 		else n_underflow_recovered += outcome;
+		if (trace.active()) trace.record(id_worker + 1, "window", sw, "ind", id_job, "K", threadData[id_worker].Kvec[w].size());
 	}
 
 	if (options.count("use-PS") && G.vecG[id_job]->ProbabilityMask.size() > 0) threadData[id_worker].maskingTransitions(id_job, options["use-PS"].as < double > ());
 
-	vector < bool > flagMerges;
+	double t1 = report.active()?thread_cpu_time():0.0;
+	int64_t s1 = trace.active()?trace.now():0;
+	compute_job & J = threadData[id_worker];
+	J.S.Variants.assign(G.vecG[id_job]->Variants, G.vecG[id_job]->Variants + DIV2(G.n_site) + MOD2(G.n_site));
+	G.vecG[id_job]->sample(J.T, J.S);
+	unsigned int n_hets;
+	n_switches[id_job] = G.vecG[id_job]->countSwitches(J.S.Variants, n_hets);
+	n_stable[id_job] = (n_switches[id_job] > options["mcmc-freeze-switches"].as < double > () * n_hets) ? 0 : min(n_stable[id_job] + 1, 255);
+	double t2 = report.active()?thread_cpu_time():0.0;
 	switch (iteration_types[iteration_stage]) {
-	case STAGE_BURN:	G.vecG[id_job]->sample(threadData[id_worker].T);
+	case STAGE_PRUN:	G.vecG[id_job]->mapMerges(J.T, options["mcmc-prune"].as < double > (), J.S);
+						G.vecG[id_job]->performMerges(J.T, J.S);
 						break;
-	case STAGE_PRUN:	G.vecG[id_job]->sample(threadData[id_worker].T);
-						G.vecG[id_job]->mapMerges(threadData[id_worker].T, options["mcmc-prune"].as < double > (), flagMerges);
-						G.vecG[id_job]->performMerges(threadData[id_worker].T, flagMerges);
-						break;
-	case STAGE_MAIN:	G.vecG[id_job]->sample(threadData[id_worker].T);
-						G.vecG[id_job]->store(threadData[id_worker].T);
+	case STAGE_MAIN:	G.vecG[id_job]->store(J.T);
 						break;
 	}
+	if (report.active()) {
+		double t3 = thread_cpu_time();
+		cpu_hmm[id_worker] += t1 - t0;
+		cpu_sample[id_worker] += t2 - t1;
+		cpu_prune[id_worker] += t3 - t2;
+	}
+	if (trace.active()) {
+		trace.record(id_worker + 1, "sampling", s1, "ind", id_job);
+		trace.record(id_worker + 1, "individual", s0, "ind", id_job);
+	}
 }
 
 void phaser::phaseWindow() {
@@ -77,38 +116,162 @@ void phaser::phaseWindow() {
 	i_workers = 0; i_jobs = 0;
 	statH.clear(); statS.clear();
 	storedKsizes.clear();
+	cpu_thread = cpu_hmm = cpu_sample = cpu_prune = vector < double > (n_thread, 0.0);
+	unsigned int n_frozen = freezeConverged();
+	report.begin();
 	if (n_thread > 1) {
 		for (int t = 0 ; t < n_thread ; t++) pthread_create( &id_workers[t] , NULL, phaseWindow_callback, static_cast<void *>(this));
 		for (int t = 0 ; t < n_thread ; t++) pthread_join( id_workers[t] , NULL);
-	} else for (int i = 0 ; i < G.n_ind ; i ++) {
-		phaseWindow(0, i);
-		vrb.progress("  * HMM computations", (i+1)*1.0/G.n_ind);
+	} else {
+		double t0 = report.active()?thread_cpu_time():0.0;
+#ifdef HMM_COUNTERS
+		openCounters();
+#endif
+		for (int i = 0 ; i < G.n_ind ; i ++) {
+			phaseWindow(0, i);
+			vrb.progress("  * HMM computations", (i+1)*1.0/G.n_ind);
+		}
+#ifdef HMM_COUNTERS
+		closeCounters();
+#endif
+		if (report.active()) cpu_thread[0] = thread_cpu_time() - t0;
+	}
+	report.end("hmm");
+	time_hmm = tac.rel_time()*1.0/1000;
+	report.metric("K_mean", statH.mean()); report.metric("K_sd", statH.sd()); report.metric("K_min", statH.min()); report.metric("K_max", statH.max());
+	report.metric("W_mean_mb", statS.mean()); report.metric("W_sd_mb", statS.sd()); report.metric("W_min_mb", statS.min()); report.metric("W_max_mb", statS.max());
+	report.metric("n_windows", statH.size()); report.metric("n_underflow_recovered", n_underflow_recovered);
+	unsigned int n_changed = 0;
+	unsigned long n_switches_total = 0;
+	for (int i = 0 ; i < G.n_ind ; i ++) if (!frozen[i]) {
+		n_changed += (n_switches[i] > 0);
+		n_switches_total += n_switches[i];
 	}
+	report.metric("n_frozen", n_frozen); report.metric("n_changed", n_changed); report.metric("n_switches", n_switches_total);
+	report.threads("cpu_s", cpu_thread); report.threads("hmm_cpu_s", cpu_hmm); report.threads("sampling_cpu_s", cpu_sample); report.threads("prune_store_cpu_s", cpu_prune);
 	if (n_underflow_recovered) vrb.bullet("HMM computations [K=" + stb.str(statH.mean(), 1) + "+/-" + stb.str(statH.sd(), 1) + " / W=" + stb.str(statS.mean(), 2) + "Mb / U=" + stb.str(n_underflow_recovered) + "] (" + stb.str(tac.rel_time()*1.0/1000, 2) + "s)");
 	else vrb.bullet("HMM computations [K=" + stb.str(statH.mean(), 1) + "+/-" + stb.str(statH.sd(), 1) + " / W=" + stb.str(statS.mean(), 2) + "Mb] (" + stb.str(tac.rel_time()*1.0/1000, 2) + "s)");
+	if (options["mcmc-freeze"].as < int > ()) vrb.bullet("Convergence [changed=" + stb.str(n_changed * 100.0 / G.n_ind, 2) + "% / switches=" + stb.str(n_switches_total) + " / frozen=" + stb.str(n_frozen * 100.0 / G.n_ind, 2) + "%]");
+}
+
+/*
+ * Individuals whose sampled haplotypes did not change (up to --mcmc-freeze-switches phase changes per
+ * het) for --mcmc-freeze iterations keep them for the rest of the main iterations: their HMM is skipped,
+ * but they still serve as conditioning haplotypes and the transition probabilities they stored so far
+ * are used when solving. Burn-in and pruning iterations always run for everyone.
+ */
+unsigned int phaser::freezeConverged() {
+	unsigned int n_frozen = 0, n_freeze = options["mcmc-freeze"].as < int > ();
+	for (int i = 0 ; i < G.n_ind ; i ++) {
+		frozen[i] = (n_freeze > 0 && iteration_types[iteration_stage] == STAGE_MAIN && n_stable[i] >= n_freeze && G.vecG[i]->ProbStored.size() > 0);
+		n_frozen += frozen[i];
+	}
+	return n_frozen;
 }
 
 void phaser::phase() {
+	checkpoint_writer writerC(H, G);
 	unsigned long n_old_segments = G.numberOfSegments(), n_new_segments = 0, current_iteration = 0;
-	for (iteration_stage = 0 ; iteration_stage < iteration_counts.size() ; iteration_stage ++) {
-		for (int iter = 0 ; iter < iteration_counts[iteration_stage] ; iter ++) {
+	time_initialisation = std::chrono::duration < double > (std::chrono::steady_clock::now() - start_time).count();
+	for (iteration_stage = resume_stage ; iteration_stage < iteration_counts.size() ; iteration_stage ++) {
+		for (int iter = (iteration_stage == resume_stage)?resume_iteration:0 ; iter < iteration_counts[iteration_stage] ; iter ++) {
 			switch (iteration_types[iteration_stage]) {
 			case STAGE_BURN:	vrb.title("Burn-in iteration [" + stb.str(iter+1) + "/" + stb.str(iteration_counts[iteration_stage]) + "]"); break;
 			case STAGE_PRUN:	vrb.title("Pruning iteration [" + stb.str(iter+1) + "/" + stb.str(iteration_counts[iteration_stage]) + "]"); break;
 			case STAGE_MAIN:	vrb.title("Main iteration [" + stb.str(iter+1) + "/" + stb.str(iteration_counts[iteration_stage]) + "]"); break;
 			}
-			H.transposeHaplotypes_V2H(false);
-			H.updatePBWTmapping();
-			H.selectPBWTarrays();
-			H.transposePBWTarrays();
+			auto iteration_start = std::chrono::steady_clock::now();
+			report.iteration(++current_iteration, iteration_types[iteration_stage] == STAGE_BURN ? "burn" : (iteration_types[iteration_stage] == STAGE_PRUN ? "prune" : "main"));
+			report.begin(); H.transposeHaplotypes_V2H(false); report.end("transpose_V2H");
+			if (numa.mode == NUMA_REPLICATE) { report.begin(); H.replicateHaplotypes(numa); report.end("numa_replicate"); }
+			report.begin(); H.updatePBWTmapping(); report.end("pbwt_mapping");
+			report.begin(); H.selectPBWTarrays(); report.end("pbwt_selection");
 			phaseWindow();
-			H.updateHaplotypes(G);
-			H.transposeHaplotypes_H2V(false);
+			report.begin(); H.updateHaplotypes(G); report.end("update");
+			report.begin(); H.transposeHaplotypes_H2V(false); report.end("transpose_H2V");
 			if (iteration_types[iteration_stage] == STAGE_PRUN) {
+				report.begin();
 				n_new_segments = G.numberOfSegments();
+				G.compact();
 				vrb.bullet("Trimming [pc=" + stb.str((1-n_new_segments*1.0/n_old_segments)*100, 2) + "%]");
-				if (options.count("use-PS")) G.masking();
+				report.end("trimming");
+				if (options.count("use-PS")) { report.begin(); G.masking(options["thread"].as < int > ()); report.end("masking"); }
 			}
+			if (options.count("checkpoint") && current_iteration % options["checkpoint-every"].as < int > () == 0) {
+				bool last = (iter + 1 == iteration_counts[iteration_stage]);
+				report.begin();
+				writerC.writeCheckpoint(options["checkpoint"].as < string > (), get_iteration_scheme(), iteration_stage + last, last ? 0 : (iter + 1));
+				report.end("checkpoint");
+			}
+			if (options.count("time-budget")) budgetIterations(iter, std::chrono::duration < double > (std::chrono::steady_clock::now() - iteration_start).count());
 		}
 	}
 }
+
+/*
+ * Plans the iterations left at the cost of the last one, keeping as much time for the finalisation as
+ * the initialisation took. When they do not fit in --time-budget, burn-in iterations are dropped first,
+ * then main iterations down to one, and then the PBWT depth is lowered assuming that the HMM time scales
+ * with it. Pruning iterations are kept since they make the next ones cheaper.
+ */
+void phaser::budgetIterations(int iter, double time_iteration) {
+	double elapsed = std::chrono::duration < double > (std::chrono::steady_clock::now() - start_time).count();
+	double time_left = options["time-budget"].as < double > () - elapsed - time_initialisation;
+	vector < unsigned int > counts_left = vector < unsigned int > (iteration_counts.size(), 0);
+	unsigned int n_left = 0, n_main_done = 0;
+	for (int s = 0 ; s < iteration_counts.size() ; s ++) {
+		if (s < iteration_stage) n_main_done += (iteration_types[s] == STAGE_MAIN) * iteration_counts[s];
+		else if (s == iteration_stage) {
+			n_main_done += (iteration_types[s] == STAGE_MAIN) * (iter + 1);
+			counts_left[s] = iteration_counts[s] - iter - 1;
+		} else counts_left[s] = iteration_counts[s];
+		n_left += counts_left[s];
+	}
+	if (n_left == 0 || n_left * time_iteration <= time_left) return;
+
+	//step1: Drop burn-in iterations, then main ones while keeping one, from the longest stages
+	string prev_scheme = get_iteration_scheme();
+	unsigned int n_fit = (time_left > 0) ? (unsigned int)(time_left / time_iteration) : 0, prev_depth = H.pbwt_depth;
+	unsigned int types [2] = { STAGE_BURN, STAGE_MAIN };
+	for (int t = 0 ; t < 2 ; t ++) {
+		while (n_left > n_fit) {
+			unsigned int n_main_left = 0;
+			int longest = -1;
+			for (int s = iteration_stage ; s < iteration_counts.size() ; s ++) {
+				if (iteration_types[s] == STAGE_MAIN) n_main_left += counts_left[s];
+				if (iteration_types[s] == types[t] && counts_left[s] > 0 && (longest < 0 || counts_left[s] > counts_left[longest])) longest = s;
+			}
+			if (longest < 0 || (types[t] == STAGE_MAIN && n_main_done + n_main_left <= 1)) break;
+			counts_left[longest] --;
+			n_left --;
+		}
+	}
+	for (int s = iteration_stage ; s < iteration_counts.size() ; s ++) iteration_counts[s] = counts_left[s] + ((s == iteration_stage) ? (iter + 1) : 0);
+
+	//step2: Lower the PBWT depth so that the iterations left fit
+	double time_other = max(0.0, time_iteration - time_hmm);
+	if (n_left > 0 && n_left * time_iteration > time_left && H.pbwt_depth > 1 && time_hmm > 0) {
+		double time_hmm_fit = time_left / n_left - time_other;
+		H.pbwt_depth = max(1, min((int)H.pbwt_depth, (int)floor(H.pbwt_depth * time_hmm_fit / time_hmm)));
+	}
+
+	if (get_iteration_scheme() == prev_scheme && H.pbwt_depth == prev_depth) return;
+	double time_planned = n_left * (time_other + time_hmm * H.pbwt_depth / prev_depth);
+	vrb.bullet("Time budget [elapsed=" + stb.str(elapsed, 1) + "s / left=" + stb.str(time_left, 1) + "s / iteration=" + stb.str(time_iteration, 2) + "s] : " + get_iteration_scheme() + " / depth=" + stb.str(H.pbwt_depth));
+	if (time_planned > time_left) vrb.warning("Time budget too short, the run will exceed it by about " + stb.str(time_planned - time_left, 0) + "s");
+}
+
+#ifdef HMM_COUNTERS
+//Counters only measure the thread that opens them, so each worker opens its own for the duration of an HMM pass
+void phaser::openCounters() {
+	static std::atomic < bool > warned (false);
+	thread_profile().clear();
+	if (!thread_counters().open() && !warned.exchange(true)) vrb.warning("Hardware counters unavailable (see /proc/sys/kernel/perf_event_paranoid), counts are zeros");
+}
+
+//Called under mutex_workers by concurrent workers
+void phaser::closeCounters() {
+	thread_counters().close();
+	hmm_profile.merge(thread_profile());
+}
+#endif
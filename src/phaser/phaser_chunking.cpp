@@ -0,0 +1,201 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2018 Olivier Delaneau, University of Lausanne
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+#include <phaser/phaser_header.h>
+
+void * phaseChunk_callback(void * ptr) {
+	phaser * S = static_cast< phaser * >( ptr );
+	int id_chunk;
+	for(;;) {
+		pthread_mutex_lock(&S->mutex_workers);
+		id_chunk = S->i_chunks ++;
+		pthread_mutex_unlock(&S->mutex_workers);
+		if (id_chunk < S->chunk_first.size()) S->phaseChunk(id_chunk);
+		else pthread_exit(NULL);
+	}
+}
+
+void phaser::makeChunks() {
+	tac.clock();
+	long bp0 = V.vec_pos[0]->bp, bp1 = V.vec_pos.back()->bp;
+	long size = (long)(options["chunk-size"].as < double > () * 1e6);
+	long overlap = (long)(options["chunk-overlap"].as < double > () * 1e6);
+	int n_chunks = max(1, (int)ceil((bp1 - bp0 + 1 - overlap) * 1.0 / size));
+	chunk_first.clear();
+	chunk_last.clear();
+	for (int c = 0, l = 0 ; c < n_chunks ; c ++) {
+		long start = bp0 + c * size, stop = (c == n_chunks - 1) ? bp1 : (start + size + overlap - 1);
+		for (l = (c?chunk_first.back():0) ; l < V.size() && V.vec_pos[l]->bp < start ; l ++);
+		int first = l;
+		for (; l < V.size() && V.vec_pos[l]->bp <= stop ; l ++);
+		int last = l - 1;
+		if (last < first) vrb.error("Chunk [" + stb.str(c+1) + "] contains no variant, increase --chunk-size");
+		if (c && first > chunk_last.back()) vrb.error("No variant in the overlap of chunks [" + stb.str(c) + "] and [" + stb.str(c+1) + "], increase --chunk-overlap");
+		chunk_first.push_back(first);
+		chunk_last.push_back(last);
+	}
+	vrb.bullet("Chunking [n=" + stb.str(n_chunks) + " / L=" + stb.str(chunk_last[0] - chunk_first[0] + 1) + " variants in the first chunk] (" + stb.str(tac.rel_time()*1.0/1000, 2) + "s)");
+}
+
+/*
+ * Copies the variants, unphased genotypes and reference haplotypes of a chunk into a phaser of its own.
+ * The chunk is then initialised from there exactly as a whole region would be.
+ */
+void phaser::sliceChunk(phaser & C, int c) {
+	int first = chunk_first[c], n_sites = chunk_last[c] - chunk_first[c] + 1;
+
+	//Variants
+	for (int l = 0 ; l < n_sites ; l ++) {
+		variant * v = new variant(*V.vec_pos[first + l]);
+		v->idx = l;
+		C.V.push(v);
+	}
+
+	//Genotypes
+	C.G.allocate(G.n_ind, n_sites);
+	for (int i = 0 ; i < G.n_ind ; i ++) {
+		C.G.vecG[i]->name = G.vecG[i]->name;
+		for (int l = 0 ; l < n_sites ; l ++) {
+			unsigned char code = (G.vecG[i]->Variants[DIV2(first + l)] >> (MOD2(first + l) << 2)) & 15;
+			C.G.vecG[i]->Variants[DIV2(l)] |= code << (MOD2(l) << 2);
+		}
+	}
+
+	//Haplotypes: only reference rows are known at this stage
+	string ooc_dir = options.count("out-of-core")?options["out-of-core"].as < string > ():"";
+	C.H.n_ind = H.n_ind;
+	C.H.n_hap = H.n_hap;
+	C.H.n_site = n_sites;
+	C.H.H_opt_var.allocate(n_sites, H.n_hap, ooc_dir);
+	C.H.H_opt_hap.allocate(H.n_hap, n_sites, ooc_dir);
+	if (H.n_hap > 2 * H.n_ind) {
+		vector < unsigned int > rows;
+		for (unsigned int h = 2 * H.n_ind ; h < H.n_hap ; h ++) rows.push_back(h);
+		bitmatrix R;
+		R.allocate(rows.size(), n_sites);
+		R.gather(H.H_opt_hap, rows, first, n_sites);
+		unsigned long n_bytes_row = C.H.H_opt_hap.n_cols / 8;
+		for (unsigned long r = 0 ; r < rows.size() ; r ++) memcpy(C.H.H_opt_hap.bytes + (2 * H.n_ind + r) * n_bytes_row, R.bytes + r * n_bytes_row, n_bytes_row);
+	}
+}
+
+void phaser::phaseChunk(int c) {
+	timer tc;
+	tc.clock();
+
+	//Sub-phaser sharing the options of this one, but with its own share of the threads
+	phaser C;
+	C.options = options;
+	C.options.erase("thread");
+	C.options.insert(std::make_pair("thread", bpo::variable_value(boost::any(n_chunk_threads), false)));
+	C.iteration_types = iteration_types;
+	C.iteration_counts = iteration_counts;
+	if (n_chunk_threads > 1) {
+		C.id_workers = vector < pthread_t > (n_chunk_threads);
+		pthread_mutex_init(&C.mutex_workers, NULL);
+	}
+
+	vrb.title("Chunk [" + stb.str(c+1) + "/" + stb.str(chunk_first.size()) + "]");
+	sliceChunk(C, c);
+	C.initialise();
+	C.phase();
+	C.finalise();
+	if (n_chunk_threads > 1) pthread_mutex_destroy(&C.mutex_workers);
+#ifdef HMM_COUNTERS
+	if (options["thread"].as < int > () > 1) pthread_mutex_lock(&mutex_workers);
+	hmm_profile.merge(C.hmm_profile);
+	if (options["thread"].as < int > () > 1) pthread_mutex_unlock(&mutex_workers);
+#endif
+
+	//Keep the phased main haplotypes only
+	unsigned long n_bytes_row = chunk_haplotypes[c].n_cols / 8;
+	for (unsigned long l = 0 ; l < C.H.n_site ; l ++) memcpy(chunk_haplotypes[c].bytes + l * n_bytes_row, C.H.H_opt_var.bytes + l * (C.H.H_opt_var.n_cols / 8), n_bytes_row);
+	chunk_reports[c] = "Chunk [" + stb.str(c+1) + "/" + stb.str(chunk_first.size()) + " / " + V.vec_pos[chunk_first[c]]->chr + ":" + stb.str(V.vec_pos[chunk_first[c]]->bp) + "-" + stb.str(V.vec_pos[chunk_last[c]]->bp) + " / L=" + stb.str(C.H.n_site) + "] (" + stb.str(tc.rel_time()*1.0/1000, 2) + "s)";
+}
+
+void phaser::phaseChunks() {
+	int n_thread = options["thread"].as < int > ();
+	int n_parallel = options["chunk-parallel"].as < int > ();
+	n_parallel = min((int)chunk_first.size(), (n_parallel > 0) ? min(n_parallel, n_thread) : n_thread);
+	n_chunk_threads = max(1, n_thread / n_parallel);
+	chunk_haplotypes = vector < bitmatrix > (chunk_first.size());
+	chunk_reports = vector < string > (chunk_first.size());
+	for (int c = 0 ; c < chunk_first.size() ; c ++) chunk_haplotypes[c].allocate(chunk_last[c] - chunk_first[c] + 1, 2 * G.n_ind);
+
+	vrb.title("Phasing chunks [" + stb.str(chunk_first.size()) + " chunks / " + stb.str(n_parallel) + " at a time / " + stb.str(n_chunk_threads) + " threads each]");
+	report.iteration(0, "chunks");
+	report.begin();
+	i_chunks = 0;
+	if (n_parallel > 1) {
+		vrb.set_muted(true);
+		for (int t = 0 ; t < n_parallel ; t++) pthread_create( &id_workers[t] , NULL, phaseChunk_callback, static_cast<void *>(this));
+		for (int t = 0 ; t < n_parallel ; t++) pthread_join( id_workers[t] , NULL);
+		vrb.set_muted(false);
+	} else for (int c = 0 ; c < chunk_first.size() ; c ++) phaseChunk(c);
+	report.end("phasing");
+	report.metric("n_chunks", chunk_first.size());
+	vrb.title("Chunks:");
+	for (int c = 0 ; c < chunk_first.size() ; c ++) vrb.bullet(chunk_reports[c]);
+}
+
+/*
+ * Chunks are joined at the middle of their overlap. Each individual of a chunk is flipped when its
+ * heterozygous sites in the overlap agree more often with the other phase of the (already ligated) previous chunk.
+ */
+void phaser::ligateChunks() {
+	report.iteration(0, "finalisation");
+	report.begin();
+	tac.clock();
+	vector < bool > flip_prev = vector < bool > (G.n_ind, false), flip_curr = vector < bool > (G.n_ind, false);
+	unsigned long n_flipped = 0;
+	for (int c = 0 ; c < chunk_first.size() ; c ++) {
+		bitmatrix & Hc = chunk_haplotypes[c];
+		if (c) {
+			bitmatrix & Hp = chunk_haplotypes[c-1];
+			for (int i = 0 ; i < G.n_ind ; i ++) {
+				int agree = 0, disagree = 0;
+				for (int l = chunk_first[c] ; l <= chunk_last[c-1] ; l ++) {
+					bool p0 = Hp.get(l - chunk_first[c-1], 2*i + flip_prev[i]);
+					bool p1 = Hp.get(l - chunk_first[c-1], 2*i + 1 - flip_prev[i]);
+					bool c0 = Hc.get(l - chunk_first[c], 2*i + 0);
+					bool c1 = Hc.get(l - chunk_first[c], 2*i + 1);
+					if (p0 != p1 && c0 != c1) (p0 == c0) ? agree ++ : disagree ++;
+				}
+				flip_curr[i] = (disagree > agree);
+				n_flipped += flip_curr[i];
+			}
+		}
+		int from = c ? ((chunk_first[c] + chunk_last[c-1] + 1) / 2) : 0;
+		int to = (c < chunk_first.size() - 1) ? ((chunk_first[c+1] + chunk_last[c] + 1) / 2 - 1) : (V.size() - 1);
+		for (int l = from ; l <= to ; l ++) {
+			for (int i = 0 ; i < G.n_ind ; i ++) {
+				H.H_opt_var.set(l, 2*i + 0, Hc.get(l - chunk_first[c], 2*i + flip_curr[i]));
+				H.H_opt_var.set(l, 2*i + 1, Hc.get(l - chunk_first[c], 2*i + 1 - flip_curr[i]));
+			}
+		}
+		if (c) chunk_haplotypes[c-1].free();
+		flip_prev.swap(flip_curr);
+		std::fill(flip_curr.begin(), flip_curr.end(), false);
+	}
+	chunk_haplotypes.back().free();
+	report.end("ligation");
+	vrb.bullet("Ligation [n=" + stb.str(chunk_first.size()) + " chunks / " + stb.str(n_flipped) + " flips] (" + stb.str(tac.rel_time()*1.0/1000, 2) + "s)");
+}
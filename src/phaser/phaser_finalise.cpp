@@ -30,13 +30,49 @@ void phaser::write_files_and_finalise() {
 	if (options["thread"].as < int > () > 1) pthread_mutex_destroy(&mutex_workers);
 
 	//
-	G.solve();
-	H.updateHaplotypes(G);
-	H.transposeHaplotypes_H2V(false);
+	if (options.count("chunk-size")) ligateChunks();
+	else finalise();
 
 	//step1: writing best guess haplotypes in VCF/BCF file
-	haplotype_writer(H, G, V).writeHaplotypes(options["output"].as < string > ());
+	write_files();
 
 	//step2: Measure overall running time
 	vrb.bullet("Total running time = " + stb.str(tac.abs_time()) + " seconds");
+	if (options.count("report")) write_report(options["report"].as < string > ());
+	if (options.count("trace")) write_trace(options["trace"].as < string > ());
+#ifdef HMM_COUNTERS
+	hmm_profile.print();
+#endif
+}
+
+void phaser::write_files() {
+	report.begin();
+	haplotype_writer(H, G, V).writeHaplotypes(options["output"].as < string > ());
+	report.end("write");
+}
+
+void phaser::finalise() {
+	report.iteration(0, "finalisation");
+	report.begin(); G.solve(options["thread"].as < int > ()); report.end("solve");
+	report.begin(); H.updateHaplotypes(G); report.end("update");
+	report.begin(); H.transposeHaplotypes_H2V(false); report.end("transpose_H2V");
+}
+
+void phaser::write_report(string fname) {
+	vector < pair < string, string > > header;
+	header.push_back(make_pair("version", "4.1.1"));
+	header.push_back(make_pair("region", options.count("region")?options["region"].as < string > ():""));
+	header.push_back(make_pair("threads", stb.str(options["thread"].as < int > ())));
+	header.push_back(make_pair("mcmc", options["mcmc-iterations"].as < string > ()));
+	header.push_back(make_pair("n_main_samples", stb.str(G.n_ind)));
+	header.push_back(make_pair("n_haplotypes", stb.str(H.n_hap)));
+	header.push_back(make_pair("n_variants", stb.str(V.size())));
+	if (!report.write(fname, header)) vrb.error("Impossible to create performance report [" + fname + "]");
+	vrb.bullet("Performance report written in [" + fname + "]");
+}
+
+void phaser::write_trace(string fname) {
+	if (!trace.write(fname)) vrb.error("Impossible to create trace file [" + fname + "]");
+	if (trace.dropped()) vrb.bullet("Timeline trace written in [" + fname + "] (oldest " + stb.str(trace.dropped()) + " events dropped)");
+	else vrb.bullet("Timeline trace written in [" + fname + "]");
 }
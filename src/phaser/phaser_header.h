@@ -25,6 +25,8 @@
 #define _PHASER_H
 
 #include <utils/otools.h>
+#include <utils/numa_policy.h>
+#include <utils/perf_report.h>
 #include <objects/hmm_parameters.h>
 #include <models/haplotype_segment.h>
 
@@ -54,17 +56,44 @@ public:
 	vector < pthread_t > id_workers;
 	pthread_mutex_t mutex_workers;
 	vector < compute_job > threadData;
+	numa_policy numa;
 
 	//MCMC
 	vector < unsigned int > iteration_types;
 	vector < unsigned int > iteration_counts;
 	unsigned int iteration_stage;
+	unsigned int resume_stage, resume_iteration;		//First iteration to run (--resume)
 	int n_underflow_recovered;
+	vector < unsigned int > n_switches;			//Phase changes of each individual at its last sampling
+	vector < unsigned char > n_stable;			//Consecutive samplings of each individual without phase change
+	vector < bool > frozen;						//Individuals whose HMM is skipped in the current pass (--mcmc-freeze)
+	std::chrono::steady_clock::time_point start_time;	//Start of the run (--time-budget)
+	double time_initialisation, time_hmm;		//Wall time before the first iteration and of the last HMM pass in seconds
 
 	//
 	basic_stats statH,statS;
 	vector < double > storedKsizes;
 
+	//PERFORMANCE REPORT
+	perf_report report;
+	trace_recorder trace;
+#ifdef HMM_COUNTERS
+	hw_profile hmm_profile;						//Hardware counters of all HMM passes, printed at the end of the run
+#endif
+	vector < double > cpu_thread, cpu_hmm, cpu_sample, cpu_prune;		//CPU seconds per worker in the last HMM pass (prune also counts storage)
+
+	//CHUNKING
+	vector < int > chunk_first, chunk_last;		//Variant range of each chunk (--chunk-size)
+	vector < bitmatrix > chunk_haplotypes;		//Phased main haplotypes of each chunk (variant first)
+	vector < string > chunk_reports;			//One line per chunk, printed once all chunks are done
+	int i_chunks, n_chunk_threads;
+
+	//REGIONS
+	vector < string > region_names, region_outputs, region_maps;	//One line of --region-list each
+	map < string, gmap_reader > region_gmaps;			//Genetic maps of the regions, read once per file
+	vector < string > region_reports;					//One line per region, printed once all regions are done
+	int i_regions, n_region_threads;
+
 	//CONSTRUCTOR
 	phaser();
 	~phaser();
@@ -73,20 +102,52 @@ public:
 	void phase();
 	void phaseWindow(int, int);
 	void phaseWindow();
+	unsigned int freezeConverged();
+	void budgetIterations(int, double);
+#ifdef HMM_COUNTERS
+	void openCounters();
+	void closeCounters();
+#endif
 
 	//PARAMETERS
 	void declare_options();
 	void parse_command_line(vector < string > &);
 	void parse_iteration_scheme(string);
 	string get_iteration_scheme();
+	void check_files();
 	void check_options();
 	void verbose_options();
 	void verbose_files();
 
 	//
 	void read_files_and_initialise();
+	void read_genotypes();
+	void initialise();
+	void initialise_workers();
+	void initialise_reports();
 	void phase(vector < string > &);
+	void finalise();
 	void write_files_and_finalise();
+	void write_files();
+	void write_report(string);
+	void write_trace(string);
+
+	//CHUNKING
+	void makeChunks();
+	void sliceChunk(phaser &, int);
+	void phaseChunk(int);
+	void phaseChunks();
+	void ligateChunks();
+
+	//REGIONS
+	void readRegionList();
+	void phaseRegion(int);
+	void phaseRegions();
+
+	//SERVER
+	void serve();
+	void serveJob(string);
+	void submit();
 };
 
 
@@ -24,6 +24,7 @@
 #include <io/genotype_reader.h>
 #include <io/haplotype_writer.h>
 #include <io/gmap_reader.h>
+#include <io/checkpoint_reader.h>
 
 #include <modules/builder.h>
 #include <modules/pbwt_solver.h>
@@ -33,49 +34,118 @@ void phaser::read_files_and_initialise() {
 
 	//step0: Initialize seed and multi-threading
 	rng.setSeed(options["seed"].as < int > ());
-	if (options["thread"].as < int > () > 1) {
-		i_workers = 0; i_jobs = 0;
-		id_workers = vector < pthread_t > (options["thread"].as < int > ());
-		pthread_mutex_init(&mutex_workers, NULL);
-	}
+	initialise_workers();
 
 	//step2: Read input files
+	initialise_reports();
+	report.iteration(0, "initialisation");
+	read_genotypes();
+
+	//step3: Read and initialise genetic map
+	report.begin();
+	if (options.count("map")) {
+		gmap_reader readerGM;
+		readerGM.readGeneticMapFile(options["map"].as < string > ());
+		V.setGeneticMap(readerGM);
+	} else V.setGeneticMap();
+	report.end("genetic_map");
+
+	//Chunks are sliced from the data read so far and initialised separately
+	if (options.count("chunk-size")) return makeChunks();
+	initialise();
+}
+
+void phaser::read_genotypes() {
+	report.begin();
 	genotype_reader readerG(H, G, V, options["region"].as < string > (), options.count("use-PS"));
 	if (!options.count("reference")) readerG.scanGenotypes(options["input"].as < string > ());
 	else readerG.scanGenotypes(options["input"].as < string > (), options["reference"].as < string > ());
-	readerG.allocateGenotypes();
+	readerG.allocateGenotypes(options.count("out-of-core")?options["out-of-core"].as < string > ():"");
 	if (!options.count("reference") && !options.count("scaffold")) readerG.readGenotypes0(options["input"].as < string > ());
 	if ( options.count("reference") && !options.count("scaffold")) readerG.readGenotypes1(options["input"].as < string > (), options["reference"].as < string > ());
 	if (!options.count("reference") &&  options.count("scaffold")) readerG.readGenotypes2(options["input"].as < string > (), options["scaffold"].as < string > ());
 	if ( options.count("reference") &&  options.count("scaffold")) readerG.readGenotypes3(options["input"].as < string > (), options["reference"].as < string > (), options["scaffold"].as < string > ());
-	G.imputeMonomorphic(V);
+	G.imputeMonomorphic(V, options["thread"].as < int > ());
+	report.end("read");
+}
 
-	//step3: Read and initialise genetic map
-	if (options.count("map")) {
-		gmap_reader readerGM;
-		readerGM.readGeneticMapFile(options["map"].as < string > ());
-		V.setGeneticMap(readerGM);
-	} else V.setGeneticMap();
-	M.initialise(V, options["effective-size"].as < int > (), (readerG.n_main_samples+readerG.n_ref_samples)*2);
+void phaser::initialise() {
+	M.initialise(V, options["effective-size"].as < int > (), H.n_hap);
 
 	//step4: Initialize haplotypes
+	report.iteration(0, "initialisation");
+	report.begin();
 	H.parametrizePBWT(options["pbwt-depth"].as < int > (), options["pbwt-modulo"].as < double > (), options["pbwt-mac"].as < int > (), options["pbwt-mdr"].as < double > (), options["thread"].as < int > ());
 	H.initializePBWTmapping(V);
 	H.allocatePBWTarrays();
-	H.updateHaplotypes(G, true);
-	H.transposeHaplotypes_H2V(true);
-	H.searchIBD2matching(V, options["ibd2-length"].as < double > (), options["window"].as < double > (), options["ibd2-maf"].as < double > (), options["ibd2-mdr"].as < double > (), options["ibd2-count"].as < int > ());
-	if (options.count("ibd2-output")) H.writeIBD2matching(G, options["ibd2-output"].as < string > ());
+	report.end("pbwt_indexing");
+	if (options.count("resume")) {
+		//Genotype graphs, phased Variants and IBD2 constraints come from the checkpoint
+		report.begin();
+		checkpoint_reader(H, G).readCheckpoint(options["resume"].as < string > (), get_iteration_scheme(), resume_stage, resume_iteration);
+		report.end("resume");
+		report.begin();
+		H.updateHaplotypes(G, true);
+		H.transposeHaplotypes_H2V(true);
+		if (H.n_hap > 2 * H.n_ind) H.buildReferencePBWT();
+		report.end("haplotypes");
+	} else {
+		report.begin();
+		H.updateHaplotypes(G, true);
+		H.transposeHaplotypes_H2V(true);
+		if (H.n_hap > 2 * H.n_ind) H.buildReferencePBWT();
+		report.end("haplotypes");
+		report.begin();
+		H.searchIBD2matching(V, options["ibd2-length"].as < double > (), options["window"].as < double > (), options["ibd2-maf"].as < double > (), options["ibd2-mdr"].as < double > (), options["ibd2-count"].as < int > ());
+		if (options.count("ibd2-output")) H.writeIBD2matching(G, options["ibd2-output"].as < string > ());
+		report.end("ibd2");
 
-	pbwt_solver solver = pbwt_solver(H);
-	solver.sweep(G);
-	solver.free();
+		report.begin();
+		pbwt_solver solver(H);
+		solver.sweep(G);
+		solver.free();
+		report.end("pbwt_sweep");
 
-	//step5: Initialize genotype structures
-	builder(G, options["thread"].as < int > ()).build();
-	if (options.count("use-PS")) G.masking();
+		//step5: Initialize genotype structures
+		report.begin();
+		builder(G, options["thread"].as < int > ()).build();
+		report.end("build");
+		report.metric("n_segments", G.numberOfSegments());
+	}
+	if (options.count("use-PS")) { report.begin(); G.masking(options["thread"].as < int > ()); report.end("masking"); }
 
 	//step6: Allocate data structures for computations
 	unsigned int max_number_transitions = G.largestNumberOfTransitions();
 	threadData = vector < compute_job >(options["thread"].as < int > (), compute_job(V, G, H, max_number_transitions));
+	n_switches = vector < unsigned int > (G.n_ind, 0);
+	n_stable = vector < unsigned char > (G.n_ind, 0);
+	frozen = vector < bool > (G.n_ind, false);
+	vrb.bullet("Huge pages [explicit=" + stb.str(huge_counters().n_hugetlb.load()) + " / transparent=" + stb.str(huge_transparentMB()) + "MB of " + stb.str(huge_counters().n_advised.load() >> 20) + "MB advised]");
+}
+
+void phaser::initialise_reports() {
+	if (options.count("report")) report.enable();
+	if (options.count("trace")) {
+		trace.enable(options["thread"].as < int > ());
+		report.attach(&trace);
+	}
+}
+
+void phaser::initialise_workers() {
+	if (options["thread"].as < int > () > 1) {
+		i_workers = 0; i_jobs = 0;
+		id_workers = vector < pthread_t > (options["thread"].as < int > ());
+		pthread_mutex_init(&mutex_workers, NULL);
+		if (options["numa"].as < string > () == "interleave") numa.mode = NUMA_INTERLEAVE;
+		if (options["numa"].as < string > () == "replicate") numa.mode = NUMA_REPLICATE;
+		if (numa.active() && !numa.detect()) {
+			vrb.warning("Single NUMA node detected, --numa is ignored");
+			numa.mode = NUMA_NONE;
+		}
+		//Shared data (haplotypes, genotype arenas, PBWT neighbours) is allocated by this thread from now on
+		if (numa.active()) {
+			numa.interleave();
+			vrb.bullet("NUMA " + numa.str() + " [nodes=" + stb.str(numa.n_nodes()) + "]");
+		}
+	}
 }
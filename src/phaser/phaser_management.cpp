@@ -22,6 +22,10 @@
 #include <phaser/phaser_header.h>
 
 phaser::phaser() {
+	resume_stage = 0;
+	resume_iteration = 0;
+	start_time = std::chrono::steady_clock::now();
+	time_initialisation = time_hmm = 0.0;
 }
 
 phaser::~phaser() {
@@ -34,11 +38,16 @@ phaser::~phaser() {
 void phaser::phase(vector < string > & args) {
 	declare_options();
 	parse_command_line(args);
+	check_files();
 	check_options();
+	if (options.count("submit")) return submit();
 	verbose_files();
 	verbose_options();
+	if (options.count("server")) return serve();
+	if (options.count("region-list")) return phaseRegions();
 	read_files_and_initialise();
-	phase();
+	if (options.count("chunk-size")) phaseChunks();
+	else phase();
 	write_files_and_finalise();
 }
 
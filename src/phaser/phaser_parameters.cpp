@@ -27,7 +27,9 @@ void phaser::declare_options() {
 	opt_base.add_options()
 			("help", "Produce help message")
 			("seed", bpo::value<int>()->default_value(15052011), "Seed of the random number generator")
-			("thread,T", bpo::value<int>()->default_value(1), "Number of thread used");
+			("thread,T", bpo::value<int>()->default_value(1), "Number of thread used")
+			("numa", bpo::value<string>()->default_value("none"), "NUMA placement of haplotype data and threads [none/interleave/replicate]")
+			("out-of-core", bpo::value<string>(), "Keep the haplotype matrices in memory-mapped files in this directory (large panels, slower)");
 
 	bpo::options_description opt_input ("Input files");
 	opt_input.add_options()
@@ -36,12 +38,20 @@ void phaser::declare_options() {
 			("scaffold,S", bpo::value< string >(), "Scaffold of haplotypes in VCF/BCF format")
 			("map,M", bpo::value< string >(), "Genetic map")
 			("region,R", bpo::value< string >(), "Target region")
+			("region-list", bpo::value< string >(), "File of regions to phase one after the other in this process, one \"region output [map]\" line each, --map being the default map (reports and traces go to [output].report.json and [output].trace.json)")
+			("region-parallel", bpo::value<int>()->default_value(1), "Number of regions of --region-list phased concurrently (0 means as many as threads)")
 			("use-PS", bpo::value<double>(), "Informs phasing using PS field from read based phasing");
 
 	bpo::options_description opt_mcmc ("MCMC parameters");
 	opt_mcmc.add_options()
 			("mcmc-iterations", bpo::value<string>()->default_value("5b,1p,1b,1p,1b,1p,5m"), "Iteration scheme of the MCMC")
-			("mcmc-prune", bpo::value<double>()->default_value(0.999), "Pruning threshold in genotype graphs");
+			("mcmc-prune", bpo::value<double>()->default_value(0.999), "Pruning threshold in genotype graphs")
+			("mcmc-freeze", bpo::value<int>()->default_value(0), "Skip the HMM of individuals whose sampled haplotypes did not change for this number of iterations in main iterations (0 means never)")
+			("mcmc-freeze-switches", bpo::value<double>()->default_value(0.0), "Phase changes per het between two iterations below which the haplotypes of an individual did not change")
+			("time-budget", bpo::value<double>(), "Wall time budget of the run in seconds, iterations and PBWT depth are lowered after each iteration to fit in it")
+			("checkpoint", bpo::value< string >(), "Write a binary snapshot of the MCMC in this file (in the background) after iterations")
+			("checkpoint-every", bpo::value<int>()->default_value(1), "Number of iterations between two checkpoints")
+			("resume", bpo::value< string >(), "Resume the MCMC from this checkpoint (same input files and options)");
 
 	bpo::options_description opt_pbwt ("PBWT parameters");
 	opt_pbwt.add_options()
@@ -66,9 +76,22 @@ void phaser::declare_options() {
 	bpo::options_description opt_output ("Output files");
 	opt_output.add_options()
 			("output,O", bpo::value< string >(), "Phased haplotypes in VCF/BCF format")
-			("log", bpo::value< string >(), "Log file");
-
-	descriptions.add(opt_base).add(opt_input).add(opt_mcmc).add(opt_pbwt).add(opt_ibd2).add(opt_hmm).add(opt_output);
+			("log", bpo::value< string >(), "Log file")
+			("report", bpo::value< string >(), "Performance report in JSON format (wall/CPU time, K/W and memory for every stage of every iteration)")
+			("trace", bpo::value< string >(), "Timeline of the serial stages and of the jobs and windows of each worker in Chrome Trace Event format");
+
+	bpo::options_description opt_chunk ("Chunking parameters");
+	opt_chunk.add_options()
+			("chunk-size", bpo::value<double>(), "Phase the region in chunks of this size in Mb, ligated internally")
+			("chunk-overlap", bpo::value<double>()->default_value(2.0), "Overlap between consecutive chunks in Mb")
+			("chunk-parallel", bpo::value<int>()->default_value(0), "Number of chunks phased concurrently (0 means as many as threads)");
+
+	bpo::options_description opt_server ("Server mode");
+	opt_server.add_options()
+			("server", bpo::value< string >(), "Keep the reference panel and map resident and phase the jobs dropped in this spool directory")
+			("submit", bpo::value< string >(), "Submit --input/--output as a job to the server watching this spool directory and wait for it");
+
+	descriptions.add(opt_base).add(opt_input).add(opt_mcmc).add(opt_pbwt).add(opt_ibd2).add(opt_hmm).add(opt_chunk).add(opt_server).add(opt_output);
 }
 
 void phaser::parse_command_line(vector < string > & args) {
@@ -89,22 +112,51 @@ void phaser::parse_command_line(vector < string > & args) {
 	vrb.bullet("Run date      : " + tac.date());
 }
 
-void phaser::check_options() {
-	if (!options.count("input"))
+void phaser::check_files() {
+	if (!options.count("input") && !options.count("server"))
 		vrb.error("You must specify one input file using --input");
 
-	if (!options.count("region"))
+	if (!options.count("region") && !options.count("submit") && !options.count("region-list"))
 		vrb.error("You must specify a region or chromosome to phase using --region");
 
-	if (!options.count("output"))
+	if (!options.count("output") && !options.count("server") && !options.count("region-list"))
 		vrb.error("You must specify a phased output file with --output");
 
+	if (options.count("region-list") && (options.count("region") || options.count("output")))
+		vrb.error("--region and --output are given by each line of --region-list");
+
+	if (options.count("region-list") && (options.count("server") || options.count("submit") || options.count("chunk-size") || options.count("checkpoint") || options.count("resume") || options.count("time-budget") || options.count("ibd2-output") || !options["numa"].defaulted()))
+		vrb.error("--region-list cannot be combined with --server, --submit, --chunk-size, --checkpoint, --resume, --time-budget, --ibd2-output or --numa");
+
+	if (options.count("server") && options.count("submit"))
+		vrb.error("--server and --submit cannot be combined");
+
+	if (options.count("server") && !options.count("reference"))
+		vrb.error("You must specify the reference panel to keep resident using --reference");
+
+	if (options.count("server") && (options.count("input") || options.count("output")))
+		vrb.error("--input and --output are given by each job in server mode");
+
+	if (options.count("server") && (options.count("scaffold") || options.count("use-PS") || options.count("chunk-size") || options.count("ibd2-output") || !options["numa"].defaulted()))
+		vrb.error("--server cannot be combined with --scaffold, --use-PS, --chunk-size, --ibd2-output or --numa");
+}
+
+void phaser::check_options() {
 	if (options.count("seed") && options["seed"].as < int > () < 0)
 		vrb.error("Random number generator needs a positive seed value");
 
 	if (options.count("thread") && options["thread"].as < int > () < 1)
 		vrb.error("You must use at least 1 thread");
 
+	if (options["numa"].as < string > () != "none" && options["numa"].as < string > () != "interleave" && options["numa"].as < string > () != "replicate")
+		vrb.error("Unrecognized NUMA policy [" + options["numa"].as < string > () + "], use none, interleave or replicate");
+
+	if (!options["numa"].defaulted() && options["thread"].as < int > () < 2)
+		vrb.warning("--numa has no effect with a single thread");
+
+	if (options.count("out-of-core") && options["numa"].as < string > () == "replicate")
+		vrb.error("--numa replicate keeps in-memory copies of the haplotypes and cannot be combined with --out-of-core");
+
 	if (!options["thread"].defaulted() && !options["seed"].defaulted())
 		vrb.warning("Using multi-threading prevents reproducing a run by specifying --seed");
 
@@ -114,34 +166,84 @@ void phaser::check_options() {
 	if (!options["window"].defaulted() && (options["window"].as < double > () < 0.5 || options["window"].as < double > () > 10))
 		vrb.error("You must specify a window size comprised between 0.5 and 10 cM");
 
+	if (options.count("chunk-size") && options["chunk-size"].as < double > () <= 0)
+		vrb.error("You must specify a positive chunk size");
+
+	if (options.count("chunk-size") && (options["chunk-overlap"].as < double > () <= 0 || options["chunk-overlap"].as < double > () >= options["chunk-size"].as < double > ()))
+		vrb.error("The chunk overlap must be positive and smaller than the chunk size");
+
+	if (options.count("chunk-size") && options["chunk-parallel"].as < int > () < 0)
+		vrb.error("You must specify a positive number of concurrent chunks");
+
+	if (options.count("chunk-size") && (options.count("use-PS") || options.count("ibd2-output")))
+		vrb.error("--chunk-size cannot be combined with --use-PS or --ibd2-output");
+
+	if (options["mcmc-freeze"].as < int > () < 0 || options["mcmc-freeze"].as < int > () > 255)
+		vrb.error("You must specify a number of stable iterations comprised between 0 and 255 with --mcmc-freeze");
+
+	if (options["mcmc-freeze-switches"].as < double > () < 0 || options["mcmc-freeze-switches"].as < double > () >= 1)
+		vrb.error("You must specify a rate of phase changes per het comprised between 0 and 1 with --mcmc-freeze-switches");
+
+	if (options.count("time-budget") && options["time-budget"].as < double > () <= 0)
+		vrb.error("You must specify a positive time budget");
+
+	if (options.count("time-budget") && (options.count("chunk-size") || options.count("server") || options.count("checkpoint") || options.count("resume")))
+		vrb.error("--time-budget cannot be combined with --chunk-size, --server, --checkpoint or --resume");
+
+	if (options["region-parallel"].as < int > () < 0)
+		vrb.error("You must specify a positive number of concurrent regions");
+
+	if (options["checkpoint-every"].as < int > () < 1)
+		vrb.error("You must specify a positive number of iterations between checkpoints");
+
+	if ((options.count("checkpoint") || options.count("resume")) && (options.count("chunk-size") || options.count("server")))
+		vrb.error("--checkpoint and --resume cannot be combined with --chunk-size or --server");
+
 	parse_iteration_scheme(options["mcmc-iterations"].as < string > ());
 }
 
 void phaser::verbose_files() {
 	vrb.title("Files:");
-	vrb.bullet("Input VCF     : [" + options["input"].as < string > () + "]");
+	if (options.count("server")) vrb.bullet("Spool dir     : [" + options["server"].as < string > () + "]");
+	if (options.count("input")) vrb.bullet("Input VCF     : [" + options["input"].as < string > () + "]");
 	if (options.count("reference")) vrb.bullet("Reference VCF : [" + options["reference"].as < string > () + "]");
 	if (options.count("scaffold")) vrb.bullet("Scaffold VCF  : [" + options["scaffold"].as < string > () + "]");
 	if (options.count("map")) vrb.bullet("Genetic Map   : [" + options["map"].as < string > () + "]");
-	vrb.bullet("Output VCF    : [" + options["output"].as < string > () + "]");
+	if (options.count("region-list")) vrb.bullet("Region list   : [" + options["region-list"].as < string > () + "]");
+	if (options.count("output")) vrb.bullet("Output VCF    : [" + options["output"].as < string > () + "]");
 	if (options.count("log")) vrb.bullet("Output LOG    : [" + options["log"].as < string > () + "]");
+	if (options.count("report")) vrb.bullet("Output REPORT : [" + options["report"].as < string > () + "]");
+	if (options.count("trace")) vrb.bullet("Output TRACE  : [" + options["trace"].as < string > () + "]");
 }
 
 void phaser::verbose_options() {
 	vrb.title("Parameters:");
 	vrb.bullet("Seed    : " + stb.str(options["seed"].as < int > ()));
 	vrb.bullet("Threads : " + stb.str(options["thread"].as < int > ()) + " threads");
+	if (options.count("out-of-core")) vrb.bullet("Memory  : haplotype matrices mapped from files in [" + options["out-of-core"].as < string > () + "]");
+	if (!options["numa"].defaulted()) vrb.bullet("NUMA    : " + options["numa"].as < string > () + " policy / workers pinned to cores");
 	vrb.bullet("MCMC    : " + get_iteration_scheme());
+	if (options.count("time-budget")) vrb.bullet("MCMC    : Time budget of " + stb.str(options["time-budget"].as < double > (), 0) + "s / iterations and PBWT depth lowered to fit");
+	if (options.count("checkpoint")) vrb.bullet("MCMC    : Checkpoint every " + stb.str(options["checkpoint-every"].as < int > ()) + " iteration(s) in [" + options["checkpoint"].as < string > () + "]");
+	if (options.count("resume")) vrb.bullet("MCMC    : Resume from [" + options["resume"].as < string > () + "]");
+	if (options["mcmc-freeze"].as < int > ()) vrb.bullet("MCMC    : Freeze individuals stable for " + stb.str(options["mcmc-freeze"].as < int > ()) + " iteration(s) [switches/het<=" + stb.str(options["mcmc-freeze-switches"].as < double > ()) + "] in main iterations");
 	vrb.bullet("PBWT    : Depth of PBWT neighbours to condition on: " + stb.str(options["pbwt-depth"].as < int > ()));
 	vrb.bullet("PBWT    : Store indexes at variants [MAC>=" + stb.str(options["pbwt-mac"].as < int > ()) + " / MDR<=" + stb.str(options["pbwt-mdr"].as < double > ()) + " / Dist=" + stb.str(options["pbwt-modulo"].as < double > ()) + " cM]");
 	vrb.bullet("HMM     : K is variable / min W is " + stb.str(options["window"].as < double > (), 2) + "cM / Ne is "+ stb.str(options["effective-size"].as < int > ()));
 	if (options.count("map")) vrb.bullet("HMM     : Recombination rates given by genetic map");
 	else vrb.bullet("HMM     : Constant recombination rate of 1cM per Mb");
+	if (options.count("chunk-size")) vrb.bullet("CHUNKS  : size=" + stb.str(options["chunk-size"].as < double > (), 2) + "Mb / overlap=" + stb.str(options["chunk-overlap"].as < double > (), 2) + "Mb");
 	if (options.count("use-PS")) vrb.bullet("HMM     : Inform phasing using VCF/PS field / Error rate of PS field is " + stb.str(options["use-PS"].as < double > ()));
 #ifdef __AVX2__
 	vrb.bullet("HMM     : AVX2 optimization active");
 #else
 	vrb.bullet("HMM     : !AVX2 optimization inactive!");
+#endif
+#ifdef HMM_HALF
+	vrb.bullet("HMM     : Half precision storage of forward/backward messages");
+#endif
+#ifdef HMM_COUNTERS
+	vrb.bullet("HMM     : Hardware counters around forward/backward/posterior passes");
 #endif
 	vrb.bullet("IBD2    : length>=" + stb.str(options["ibd2-length"].as < double > (), 2) + "cM [N>="+ stb.str(options["ibd2-count"].as < int > ()) + " / MAF>=" + stb.str(options["ibd2-maf"].as < double > (), 3) + " / MDR<=" + stb.str(options["ibd2-mdr"].as < double > (), 3) + "]");
 	if (options.count("ibd2-output")) vrb.bullet("IBD2    : write IBD2 tracks in [" +  options["ibd2-output"].as < string > () + "]");
@@ -0,0 +1,135 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2018 Olivier Delaneau, University of Lausanne
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+#include <phaser/phaser_header.h>
+
+#include <io/haplotype_writer.h>
+
+void * phaseRegion_callback(void * ptr) {
+	phaser * S = static_cast< phaser * >( ptr );
+	int id_region;
+	for(;;) {
+		pthread_mutex_lock(&S->mutex_workers);
+		id_region = S->i_regions ++;
+		pthread_mutex_unlock(&S->mutex_workers);
+		if (id_region < S->region_names.size()) S->phaseRegion(id_region);
+		else pthread_exit(NULL);
+	}
+}
+
+void phaser::readRegionList() {
+	string fname = options["region-list"].as < string > (), line;
+	input_file fd (fname);
+	if (fd.fail()) vrb.error("Impossible to open region list [" + fname + "]");
+	vector < string > tokens;
+	while (getline(fd, line)) {
+		if (line.empty() || line[0] == '#' || stb.split(line, tokens) == 0) continue;
+		if (tokens.size() < 2 || tokens.size() > 3) vrb.error("Lines of [" + fname + "] must be \"region output [map]\": " + line);
+		region_names.push_back(tokens[0]);
+		region_outputs.push_back(tokens[1]);
+		region_maps.push_back((tokens.size() == 3) ? tokens[2] : (options.count("map") ? options["map"].as < string > () : ""));
+	}
+	fd.close();
+	if (region_names.empty()) vrb.error("No region in [" + fname + "]");
+}
+
+/*
+ * Each region is phased by a sub-phaser that shares the options, the parsed iteration scheme and the
+ * genetic maps of this one, with its own share of the threads, exactly as a single --region run would.
+ */
+void phaser::phaseRegion(int r) {
+	timer tr;
+	tr.clock();
+
+	phaser R;
+	R.options = options;
+	R.options.erase("thread");
+	R.options.insert(std::make_pair("thread", bpo::variable_value(boost::any(n_region_threads), false)));
+	R.options.insert(std::make_pair("region", bpo::variable_value(boost::any(region_names[r]), false)));
+	R.options.insert(std::make_pair("output", bpo::variable_value(boost::any(region_outputs[r]), false)));
+	R.iteration_types = iteration_types;
+	R.iteration_counts = iteration_counts;
+	if (n_region_threads > 1) {
+		R.id_workers = vector < pthread_t > (n_region_threads);
+		pthread_mutex_init(&R.mutex_workers, NULL);
+	}
+
+	//Same random stream as a --region run when regions are phased one after the other
+	vrb.title("Region [" + stb.str(r+1) + "/" + stb.str(region_names.size()) + " / " + region_names[r] + "]");
+	rng.setSeed(options["seed"].as < int > ());
+	R.initialise_reports();
+	R.report.iteration(0, "initialisation");
+	R.read_genotypes();
+	R.report.begin();
+	if (!region_maps[r].empty()) R.V.setGeneticMap(region_gmaps.at(region_maps[r]));
+	else R.V.setGeneticMap();
+	R.report.end("genetic_map");
+	R.initialise();
+	R.phase();
+	vrb.title("Finalization:");
+	R.finalise();
+	R.write_files();
+	if (n_region_threads > 1) pthread_mutex_destroy(&R.mutex_workers);
+	if (options.count("report")) R.write_report(region_outputs[r] + ".report.json");
+	if (options.count("trace")) R.write_trace(region_outputs[r] + ".trace.json");
+#ifdef HMM_COUNTERS
+	if (options["thread"].as < int > () > 1) pthread_mutex_lock(&mutex_workers);
+	hmm_profile.merge(R.hmm_profile);
+	if (options["thread"].as < int > () > 1) pthread_mutex_unlock(&mutex_workers);
+#endif
+	region_reports[r] = "Region [" + stb.str(r+1) + "/" + stb.str(region_names.size()) + " / " + region_names[r] + " / Nm=" + stb.str(R.G.n_ind) + " / L=" + stb.str(R.V.size()) + "] written in [" + region_outputs[r] + "] (" + stb.str(tr.rel_time()*1.0/1000, 2) + "s)";
+}
+
+/*
+ * --region-list: options, threads and genetic maps are set up once for all the regions, which are then
+ * phased one after the other, or --region-parallel at a time with the threads split between them.
+ */
+void phaser::phaseRegions() {
+	vrb.title("Initialization:");
+	rng.setSeed(options["seed"].as < int > ());
+	initialise_workers();
+	readRegionList();
+	tac.clock();
+	for (int r = 0 ; r < region_maps.size() ; r ++) if (!region_maps[r].empty() && !region_gmaps.count(region_maps[r])) region_gmaps[region_maps[r]].readGeneticMapFile(region_maps[r]);
+	if (!region_gmaps.empty()) vrb.bullet("Genetic maps [n=" + stb.str(region_gmaps.size()) + "] (" + stb.str(tac.rel_time()*1.0/1000, 2) + "s)");
+
+	int n_thread = options["thread"].as < int > ();
+	int n_parallel = options["region-parallel"].as < int > ();
+	n_parallel = min((int)region_names.size(), (n_parallel > 0) ? min(n_parallel, n_thread) : n_thread);
+	n_region_threads = max(1, n_thread / n_parallel);
+	region_reports = vector < string > (region_names.size());
+	vrb.title("Phasing regions [" + stb.str(region_names.size()) + " regions / " + stb.str(n_parallel) + " at a time / " + stb.str(n_region_threads) + " threads each]");
+	i_regions = 0;
+	if (n_parallel > 1) {
+		vrb.set_muted(true);
+		for (int t = 0 ; t < n_parallel ; t++) pthread_create( &id_workers[t] , NULL, phaseRegion_callback, static_cast<void *>(this));
+		for (int t = 0 ; t < n_parallel ; t++) pthread_join( id_workers[t] , NULL);
+		vrb.set_muted(false);
+	} else for (int r = 0 ; r < region_names.size() ; r ++) phaseRegion(r);
+	if (n_thread > 1) pthread_mutex_destroy(&mutex_workers);
+
+	vrb.title("Regions:");
+	for (int r = 0 ; r < region_names.size() ; r ++) vrb.bullet(region_reports[r]);
+	vrb.bullet("Total running time = " + stb.str(tac.abs_time()) + " seconds");
+#ifdef HMM_COUNTERS
+	hmm_profile.print();
+#endif
+}
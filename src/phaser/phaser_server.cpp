@@ -0,0 +1,182 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2018 Olivier Delaneau, University of Lausanne
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+#include <phaser/phaser_header.h>
+
+#include <io/genotype_reader.h>
+#include <io/haplotype_writer.h>
+#include <io/gmap_reader.h>
+
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define SERVER_POLL_US	200000
+
+string absolutePath(string path) {
+	if (path.empty() || path[0] == '/') return path;
+	char cwd [4096];
+	if (getcwd(cwd, sizeof(cwd)) == NULL) return path;
+	return string(cwd) + "/" + path;
+}
+
+/*
+ * Loads the reference panel and the genetic map once, then phases the jobs dropped in the spool directory
+ * (--server). A job is a file [name].job holding "input <file>" and "output <file>" lines. It is renamed
+ * [name].run while it runs, then [name].done or [name].fail; its log goes to [name].log (and its performance
+ * report and trace to [name].report.json and [name].trace.json with --report and --trace). Each job runs in a
+ * forked process, so that it shares the resident reference copy-on-write and a failing job cannot bring the
+ * server down. Creating a file named "shutdown" in the spool directory stops the server.
+ */
+void phaser::serve() {
+	string spool = options["server"].as < string > ();
+	vrb.title("Server initialization:");
+
+	//step0: Read the reference panel once
+	genotype_reader readerR(H, G, V, options["region"].as < string > (), false);
+	readerR.scanReference(options["reference"].as < string > ());
+	readerR.readReference(options["reference"].as < string > (), options.count("out-of-core")?options["out-of-core"].as < string > ():"");
+
+	//step1: Read the genetic map once and keep the positions of the reference variants in cM
+	if (options.count("map")) {
+		gmap_reader readerGM;
+		readerGM.readGeneticMapFile(options["map"].as < string > ());
+		V.setGeneticMap(readerGM);
+	} else V.setGeneticMap();
+
+	//step2: Serve jobs in order of submission until asked to stop
+	vrb.title("Serving jobs in [" + spool + "]:");
+	int n_done = 0, n_failed = 0;
+	for (;;) {
+		if (access((spool + "/shutdown").c_str(), F_OK) == 0) {
+			remove((spool + "/shutdown").c_str());
+			break;
+		}
+		vector < string > jobs;
+		DIR * dir = opendir(spool.c_str());
+		if (dir == NULL) vrb.error("Impossible to open spool directory [" + spool + "]");
+		for (struct dirent * entry = readdir(dir) ; entry != NULL ; entry = readdir(dir)) {
+			string fname = string(entry->d_name);
+			if (fname.size() > 4 && fname.substr(fname.size() - 4) == ".job") jobs.push_back(fname.substr(0, fname.size() - 4));
+		}
+		closedir(dir);
+		if (jobs.empty()) { usleep(SERVER_POLL_US); continue; }
+		sort(jobs.begin(), jobs.end());
+
+		for (int j = 0 ; j < jobs.size() ; j ++) {
+			string job = spool + "/" + jobs[j];
+			if (rename((job + ".job").c_str(), (job + ".run").c_str()) != 0) continue;
+			timer tj;
+			tj.clock();
+			cout.flush();
+			pid_t pid = fork();
+			if (pid == 0) {
+				serveJob(job);
+				exit(EXIT_SUCCESS);
+			}
+			int status = 0;
+			if (pid > 0) waitpid(pid, &status, 0);
+			bool success = (pid > 0 && WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+			rename((job + ".run").c_str(), (job + (success?".done":".fail")).c_str());
+			success?n_done++:n_failed++;
+			vrb.bullet("Job [" + jobs[j] + "] " + (success?"done":"failed") + " (" + stb.str(tj.rel_time()*1.0/1000, 2) + "s)");
+		}
+	}
+	vrb.bullet("Server stopped [done=" + stb.str(n_done) + " / failed=" + stb.str(n_failed) + "]");
+	vrb.bullet("Total running time = " + stb.str(tac.abs_time()) + " seconds");
+}
+
+/*
+ * Runs in the forked process: reads the target genotypes at the resident reference variants and phases
+ * them exactly as a single --region run would.
+ */
+void phaser::serveJob(string job) {
+	vrb.close_log();
+	vrb.set_silent();
+	if (!vrb.open_log(job + ".log")) vrb.error("Impossible to create log file [" + job + ".log]");
+
+	map < string, string > fields;
+	string key, value;
+	ifstream fd (job + ".run");
+	while (fd >> key >> value) fields[key] = value;
+	fd.close();
+	if (!fields.count("input") || !fields.count("output")) vrb.error("Job [" + job + "] must give an input and an output file");
+
+	phaser J;
+	J.options = options;
+	J.iteration_types = iteration_types;
+	J.iteration_counts = iteration_counts;
+	int n_thread = options["thread"].as < int > ();
+	rng.setSeed(options["seed"].as < int > ());
+	if (n_thread > 1) {
+		J.id_workers = vector < pthread_t > (n_thread);
+		pthread_mutex_init(&J.mutex_workers, NULL);
+	}
+
+	vrb.title("Job [" + job + "]:");
+	vrb.bullet("Input VCF     : [" + fields["input"] + "]");
+	vrb.bullet("Output VCF    : [" + fields["output"] + "]");
+	string ooc_dir = options.count("out-of-core")?options["out-of-core"].as < string > ():"";
+	J.initialise_reports();
+	J.report.begin();
+	genotype_reader readerG(J.H, J.G, J.V, options["region"].as < string > (), false);
+	readerG.scanGenotypes(fields["input"], H, V);
+	readerG.allocateGenotypes(ooc_dir);
+	readerG.readGenotypes4(fields["input"], H, V);
+	J.G.imputeMonomorphic(J.V, n_thread);
+	J.report.end("read");
+	J.initialise();
+	J.phase();
+	J.finalise();
+	if (n_thread > 1) pthread_mutex_destroy(&J.mutex_workers);
+	J.report.begin();
+	haplotype_writer(J.H, J.G, J.V).writeHaplotypes(fields["output"]);
+	J.report.end("write");
+	if (options.count("report")) J.write_report(job + ".report.json");
+	if (options.count("trace")) J.write_trace(job + ".trace.json");
+#ifdef HMM_COUNTERS
+	J.hmm_profile.print();
+#endif
+}
+
+/*
+ * Stand-in client (--submit): drops --input/--output as a job in the spool directory and waits for the server.
+ */
+void phaser::submit() {
+	string spool = options["submit"].as < string > ();
+	string name = "job_" + stb.str((long)time(NULL)) + "_" + stb.str(getpid());
+	string job = spool + "/" + name;
+	ofstream fd (job + ".tmp");
+	if (fd.fail()) vrb.error("Impossible to write in spool directory [" + spool + "]");
+	fd << "input " << absolutePath(options["input"].as < string > ()) << endl;
+	fd << "output " << absolutePath(options["output"].as < string > ()) << endl;
+	fd.close();
+	if (rename((job + ".tmp").c_str(), (job + ".job").c_str()) != 0) vrb.error("Impossible to submit job [" + job + "]");
+
+	vrb.title("Job [" + name + "] submitted to [" + spool + "]");
+	for (;;) {
+		if (access((job + ".done").c_str(), F_OK) == 0) break;
+		if (access((job + ".fail").c_str(), F_OK) == 0) vrb.error("Job failed, see [" + job + ".log]");
+		usleep(SERVER_POLL_US);
+	}
+	vrb.bullet("Job done, log in [" + job + ".log]");
+	vrb.bullet("Total running time = " + stb.str(tac.abs_time()) + " seconds");
+}
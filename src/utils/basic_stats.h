@@ -31,6 +31,8 @@ protected:
 	double m_newM;
 	double m_oldS;
 	double m_newS;
+	double m_min;
+	double m_max;
 
 public:
 	basic_stats() {
@@ -39,6 +41,8 @@ public:
 		m_newM = 0;
 		m_oldS = 0;
 		m_newS = 0;
+		m_min = 0;
+		m_max = 0;
 	}
 
 	template <class T>
@@ -48,6 +52,8 @@ public:
 		m_newM = 0;
 		m_oldS = 0;
 		m_newS = 0;
+		m_min = 0;
+		m_max = 0;
 		for (uint32_t e = 0 ; e < X.size() ; e ++) push(X[e]);
 	}
 
@@ -57,6 +63,8 @@ public:
 		m_newM = 0;
 		m_oldS = 0;
 		m_newS = 0;
+		m_min = 0;
+		m_max = 0;
 	}
 
 	template <class T>
@@ -65,7 +73,10 @@ public:
 		if (m_n == 1) {
 			m_oldM = m_newM = x;
 			m_oldS = 0.0;
+			m_min = m_max = x;
 		} else {
+			if (x < m_min) m_min = x;
+			if (x > m_max) m_max = x;
 			m_newM = m_oldM + (x - m_oldM)/m_n;
             m_newS = m_oldS + (x - m_oldM)*(x - m_newM);
             m_oldM = m_newM;
@@ -81,6 +92,14 @@ public:
 		return (m_n > 0) ? m_newM : 0.0;
 	}
 
+	double min() const {
+		return m_min;
+	}
+
+	double max() const {
+		return m_max;
+	}
+
 	double variance() const {
 		return ( (m_n > 1) ? m_newS/(m_n - 1) : 0.0 );
 	}
@@ -0,0 +1,147 @@
+/*******************************************************************************
+ * Copyright (C) 2018 Olivier Delaneau, University of Lausanne
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#ifndef _HUGE_PAGES_H
+#define _HUGE_PAGES_H
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <atomic>
+#include <cstdlib>
+#include <cstdint>
+
+#include <sys/mman.h>
+
+#define HUGE_PAGE_SIZE	(2UL << 20)
+#define HUGE_MIN_BYTES	(4UL << 20)		//Smaller allocations go through malloc
+
+/*
+ * Allocation path for the large arrays (bitmatrix, genotype arenas, PBWT neighbours).
+ * Requests of at least HUGE_MIN_BYTES are mapped with explicit huge pages (MAP_HUGETLB) when the system
+ * has some reserved, and otherwise as 2MB aligned anonymous memory advised for transparent huge pages.
+ * Mapped memory comes zeroed and is only placed on first touch, which keeps the NUMA policy effective.
+ */
+struct huge_stats {
+	std::atomic < unsigned long > n_hugetlb;	//#explicit huge pages mapped so far
+	std::atomic < unsigned long > n_advised;	//#bytes advised for transparent huge pages so far
+
+	huge_stats() : n_hugetlb(0), n_advised(0) {
+	}
+};
+
+inline
+huge_stats & huge_counters() {
+	static huge_stats S;
+	return S;
+}
+
+inline
+unsigned long huge_round(unsigned long bytes) {
+	return (bytes + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+}
+
+inline
+void * huge_alloc(unsigned long bytes) {
+	if (bytes < HUGE_MIN_BYTES) return calloc(bytes, 1);
+	unsigned long len = huge_round(bytes);
+#ifdef MAP_HUGETLB
+	void * ptr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (ptr != MAP_FAILED) {
+		huge_counters().n_hugetlb += len / HUGE_PAGE_SIZE;
+		return ptr;
+	}
+#endif
+	//Over-map by one huge page and trim both ends so that the block is 2MB aligned
+	unsigned char * raw = (unsigned char *)mmap(NULL, len + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if ((void*)raw == MAP_FAILED) return NULL;
+	unsigned char * aligned = (unsigned char *)huge_round((unsigned long)raw);
+	if (aligned > raw) munmap(raw, aligned - raw);
+	if (raw + HUGE_PAGE_SIZE > aligned) munmap(aligned + len, raw + HUGE_PAGE_SIZE - aligned);
+#ifdef MADV_HUGEPAGE
+	madvise(aligned, len, MADV_HUGEPAGE);
+#endif
+	huge_counters().n_advised += len;
+	return aligned;
+}
+
+//bytes must be the size given to huge_alloc
+inline
+void huge_free(void * ptr, unsigned long bytes) {
+	if (ptr == NULL) return;
+	if (bytes < HUGE_MIN_BYTES) free(ptr);
+	else munmap(ptr, huge_round(bytes));
+}
+
+/*
+ * STL allocator on top of huge_alloc, so that std::vector based arrays share the same path.
+ */
+template < class T >
+struct huge_allocator {
+	typedef T value_type;
+
+	huge_allocator() {
+	}
+
+	template < class U >
+	huge_allocator(const huge_allocator < U > &) {
+	}
+
+	T * allocate(std::size_t n) {
+		T * ptr = (T *)huge_alloc(n * sizeof(T));
+		if (ptr == NULL) throw std::bad_alloc();
+		return ptr;
+	}
+
+	void deallocate(T * ptr, std::size_t n) {
+		huge_free(ptr, n * sizeof(T));
+	}
+};
+
+template < class T, class U >
+inline
+bool operator==(const huge_allocator < T > &, const huge_allocator < U > &) {
+	return true;
+}
+
+template < class T, class U >
+inline
+bool operator!=(const huge_allocator < T > &, const huge_allocator < U > &) {
+	return false;
+}
+
+template < class T >
+using huge_vector = std::vector < T, huge_allocator < T > >;
+
+//Transparent huge pages actually backing the process, in MB (AnonHugePages of /proc/self/smaps_rollup)
+inline
+unsigned long huge_transparentMB() {
+	std::ifstream fd ("/proc/self/smaps_rollup");
+	std::string key;
+	unsigned long value;
+	while (fd >> key) {
+		if (key == "AnonHugePages:" && (fd >> value)) return value / 1024;
+		fd.ignore(1024, '\n');
+	}
+	return 0;
+}
+
+#endif
@@ -0,0 +1,181 @@
+/*******************************************************************************
+ * Copyright (C) 2018 Olivier Delaneau, University of Lausanne
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#ifndef _HW_COUNTERS_H
+#define _HW_COUNTERS_H
+
+//Hardware counters around the HMM kernels, only compiled with -DHMM_COUNTERS (Linux perf_event_open)
+#ifdef HMM_COUNTERS
+
+#include <utils/otools.h>
+
+#include <atomic>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define HWC_NUMBER		4		//cycles, instructions, LLC misses, dTLB load misses
+#define HWC_BUCKETS		16		//log2 buckets of K and of the window length in loci
+#define HWC_FORWARD		0
+#define HWC_BACKWARD	1
+#define HWC_POSTERIOR	2
+#define HWC_STAGES		3
+
+//Counter group of the calling thread; it must be opened by the thread it measures
+class hw_counters {
+protected:
+	int fd[HWC_NUMBER];
+
+	int open_event(unsigned int type, unsigned long config, int group) {
+		struct perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = type;
+		attr.config = config;
+		attr.disabled = (group < 0);
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_GROUP;
+		return syscall(__NR_perf_event_open, &attr, 0, -1, group, 0);
+	}
+
+public:
+	hw_counters() {
+		for (int c = 0 ; c < HWC_NUMBER ; c ++) fd[c] = -1;
+	}
+
+	~hw_counters() {
+		close();
+	}
+
+	bool open() {
+		close();
+		fd[0] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, -1);
+		if (fd[0] < 0) return false;
+		fd[1] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, fd[0]);
+		fd[2] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, fd[0]);
+		fd[3] = open_event(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16), fd[0]);
+		for (int c = 1 ; c < HWC_NUMBER ; c ++) if (fd[c] < 0) { close(); return false; }
+		ioctl(fd[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+		ioctl(fd[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+		return true;
+	}
+
+	void close() {
+		for (int c = HWC_NUMBER - 1 ; c >= 0 ; c --) if (fd[c] >= 0) { ::close(fd[c]); fd[c] = -1; }
+	}
+
+	bool active() const {
+		return fd[0] >= 0;
+	}
+
+	//Current values of the group, zeros when the counters could not be opened
+	void read(uint64_t * values) const {
+		uint64_t buffer[HWC_NUMBER + 1];
+		if (fd[0] < 0 || ::read(fd[0], buffer, sizeof(buffer)) != sizeof(buffer)) {
+			for (int c = 0 ; c < HWC_NUMBER ; c ++) values[c] = 0;
+			return;
+		}
+		for (int c = 0 ; c < HWC_NUMBER ; c ++) values[c] = buffer[c + 1];
+	}
+};
+
+//Counter deltas summed by HMM stage, K bucket and window length bucket
+class hw_profile {
+protected:
+	uint64_t values[HWC_STAGES][HWC_BUCKETS][HWC_BUCKETS][HWC_NUMBER];
+	uint64_t n_windows[HWC_BUCKETS][HWC_BUCKETS];
+	uint64_t n_loci[HWC_BUCKETS][HWC_BUCKETS];
+	uint64_t n_states[HWC_BUCKETS][HWC_BUCKETS];		//Sum of K x loci
+
+	static int bucket(unsigned long x) {
+		int b = 0;
+		while (x > 1 && b < HWC_BUCKETS - 1) { x >>= 1; b ++; }
+		return b;
+	}
+
+public:
+	hw_profile() {
+		clear();
+	}
+
+	void clear() {
+		memset(values, 0, sizeof(values));
+		memset(n_windows, 0, sizeof(n_windows));
+		memset(n_loci, 0, sizeof(n_loci));
+		memset(n_states, 0, sizeof(n_states));
+	}
+
+	//v holds HWC_STAGES+1 consecutive readings taken around forward, backward and the posterior pass
+	void push(unsigned int K, unsigned int L, uint64_t v[][HWC_NUMBER]) {
+		int kb = bucket(K), lb = bucket(L);
+		for (int s = 0 ; s < HWC_STAGES ; s ++)
+			for (int c = 0 ; c < HWC_NUMBER ; c ++) values[s][kb][lb][c] += v[s+1][c] - v[s][c];
+		n_windows[kb][lb] ++;
+		n_loci[kb][lb] += L;
+		n_states[kb][lb] += (uint64_t)K * L;
+	}
+
+	void merge(const hw_profile & P) {
+		for (int s = 0 ; s < HWC_STAGES ; s ++) for (int k = 0 ; k < HWC_BUCKETS ; k ++) for (int l = 0 ; l < HWC_BUCKETS ; l ++) for (int c = 0 ; c < HWC_NUMBER ; c ++) values[s][k][l][c] += P.values[s][k][l][c];
+		for (int k = 0 ; k < HWC_BUCKETS ; k ++) for (int l = 0 ; l < HWC_BUCKETS ; l ++) {
+			n_windows[k][l] += P.n_windows[k][l];
+			n_loci[k][l] += P.n_loci[k][l];
+			n_states[k][l] += P.n_states[k][l];
+		}
+	}
+
+	//One line per stage and non empty bucket, counts are per locus step
+	void print() const {
+		const char * stages [HWC_STAGES] = {"forward", "backward", "posterior"};
+		vrb.title("HMM hardware counters [per locus step]:");
+		for (int k = 0 ; k < HWC_BUCKETS ; k ++) for (int l = 0 ; l < HWC_BUCKETS ; l ++) {
+			if (!n_windows[k][l]) continue;
+			for (int s = 0 ; s < HWC_STAGES ; s ++) {
+				const uint64_t * v = values[s][k][l];
+				double nl = n_loci[k][l];
+				string str = string(stages[s]) + " [K=" + stb.str(1UL << k) + "-" + stb.str((2UL << k) - 1) + " / L=" + stb.str(1UL << l) + "-" + stb.str((2UL << l) - 1) + " / n=" + stb.str(n_windows[k][l]) + "]";
+				str += " cycles=" + stb.str(v[0] / nl, 1) + " (" + stb.str(v[0] * 1.0 / n_states[k][l], 2) + "/state)";
+				str += " IPC=" + stb.str(v[0] ? (v[1] * 1.0 / v[0]) : 0.0, 2);
+				str += " LLC=" + stb.str(v[2] / nl, 3);
+				str += " dTLB=" + stb.str(v[3] / nl, 3);
+				vrb.bullet(str);
+			}
+		}
+	}
+};
+
+//Counters and profile of the calling thread
+inline hw_counters & thread_counters() {
+	static thread_local hw_counters C;
+	return C;
+}
+
+inline hw_profile & thread_profile() {
+	static thread_local hw_profile P;
+	return P;
+}
+
+#endif
+
+#endif
@@ -0,0 +1,172 @@
+/*******************************************************************************
+ * Copyright (C) 2018 Olivier Delaneau, University of Lausanne
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#ifndef _NUMA_POLICY_H
+#define _NUMA_POLICY_H
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+
+#ifdef HAVE_LIBNUMA
+#include <numa.h>
+#endif
+
+#define NUMA_NONE		0
+#define NUMA_INTERLEAVE	1
+#define NUMA_REPLICATE	2
+
+//Linux memory policy constants (see mempolicy.h), used for the raw system calls
+#define NUMA_MPOL_DEFAULT		0
+#define NUMA_MPOL_BIND			2
+#define NUMA_MPOL_INTERLEAVE	3
+#define NUMA_MPOL_MF_MOVE		(1<<1)
+
+/*
+ * Memory placement and thread pinning on multi-socket machines.
+ * Relies on libnuma when compiled with -DHAVE_LIBNUMA, on sysfs and raw mbind/set_mempolicy/sched_setaffinity otherwise.
+ */
+class numa_policy {
+public:
+	int mode;
+	std::vector < int > node_ids;						//Identifier of each NUMA node
+	std::vector < std::vector < int > > node_cpus;	//CPUs of each NUMA node
+
+	numa_policy() {
+		mode = NUMA_NONE;
+	}
+
+	~numa_policy() {
+		node_ids.clear();
+		node_cpus.clear();
+	}
+
+	unsigned int n_nodes() {
+		return node_cpus.size();
+	}
+
+	bool active() {
+		return (mode != NUMA_NONE);
+	}
+
+	//Discovers the NUMA topology; returns false when there is a single node (nothing to do)
+	bool detect() {
+		node_ids.clear();
+		node_cpus.clear();
+#ifdef HAVE_LIBNUMA
+		if (numa_available() < 0) return false;
+		struct bitmask * cpus = numa_allocate_cpumask();
+		for (int n = 0 ; n <= numa_max_node() ; n ++) {
+			if (numa_node_to_cpus(n, cpus) < 0) continue;
+			std::vector < int > list;
+			for (unsigned int c = 0 ; c < cpus->size ; c ++) if (numa_bitmask_isbitset(cpus, c)) list.push_back(c);
+			if (!list.empty()) { node_ids.push_back(n); node_cpus.push_back(list); }
+		}
+		numa_free_cpumask(cpus);
+#else
+		for (int n = 0 ; n < 64 ; n ++) {
+			std::ifstream fd ("/sys/devices/system/node/node" + std::to_string(n) + "/cpulist");
+			if (!fd.good()) continue;
+			std::string line, range;
+			std::getline(fd, line);
+			std::vector < int > list;
+			std::stringstream ss(line);
+			while (std::getline(ss, range, ',')) {
+				if (range.empty()) continue;
+				size_t dash = range.find('-');
+				int c0 = std::stoi(range.substr(0, dash));
+				int c1 = (dash == std::string::npos)?c0:std::stoi(range.substr(dash+1));
+				for (int c = c0 ; c <= c1 ; c ++) list.push_back(c);
+			}
+			if (!list.empty()) { node_ids.push_back(n); node_cpus.push_back(list); }
+		}
+#endif
+		return (node_cpus.size() > 1);
+	}
+
+	//Node on which worker [worker] out of [n_workers] runs; workers are spread in contiguous blocks over the nodes
+	int node(int worker, int n_workers) {
+		if (node_cpus.size() < 2 || n_workers < 1) return 0;
+		return (int)(((long)worker * node_cpus.size()) / n_workers);
+	}
+
+	//Pins the calling thread to one core of its node and makes its allocations node local
+	void pin(int worker, int n_workers) {
+		if (!active() || node_cpus.size() < 2) return;
+		int n = node(worker, n_workers);
+		int first = (int)(((long)n * n_workers + node_cpus.size() - 1) / node_cpus.size());
+		int cpu = node_cpus[n][(worker - first) % node_cpus[n].size()];
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		sched_setaffinity(0, sizeof(cpu_set_t), &set);
+#ifdef HAVE_LIBNUMA
+		numa_set_localalloc();
+#else
+		syscall(SYS_set_mempolicy, NUMA_MPOL_DEFAULT, NULL, 0);
+#endif
+	}
+
+	//Interleaves all subsequent allocations of the calling thread over all nodes
+	void interleave() {
+		if (!active() || node_cpus.size() < 2) return;
+#ifdef HAVE_LIBNUMA
+		numa_set_interleave_mask(numa_all_nodes_ptr);
+#else
+		unsigned long mask = allNodes();
+		syscall(SYS_set_mempolicy, NUMA_MPOL_INTERLEAVE, &mask, sizeof(unsigned long) * 8);
+#endif
+	}
+
+	//Moves the pages of [ptr, ptr+len) onto the n-th node (raw mbind in both builds: libnuma has no call that migrates already touched pages)
+	void bind(void * ptr, unsigned long len, int n) {
+		if (!active() || node_cpus.size() < 2 || len == 0) return;
+		unsigned long page = sysconf(_SC_PAGESIZE);
+		unsigned long start = (((unsigned long)ptr) + page - 1) & ~(page - 1);
+		unsigned long stop = (((unsigned long)ptr) + len) & ~(page - 1);
+		if (stop <= start) return;
+		unsigned long mask = 1UL << node_ids[n];
+		syscall(SYS_mbind, start, stop - start, NUMA_MPOL_BIND, &mask, sizeof(unsigned long) * 8, NUMA_MPOL_MF_MOVE);
+	}
+
+	std::string str() {
+		switch (mode) {
+		case NUMA_INTERLEAVE:	return "interleave";
+		case NUMA_REPLICATE:	return "replicate";
+		default:				return "none";
+		}
+	}
+
+protected:
+	unsigned long allNodes() {
+		unsigned long mask = 0;
+		for (unsigned int n = 0 ; n < node_cpus.size() && n < 64 ; n ++) mask |= (1UL << node_ids[n]);
+		return mask;
+	}
+};
+
+#endif
@@ -0,0 +1,180 @@
+/*******************************************************************************
+ * Copyright (C) 2018 Olivier Delaneau, University of Lausanne
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#ifndef _PERF_REPORT_H
+#define _PERF_REPORT_H
+
+#include <chrono>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <utility>
+
+#include <sys/resource.h>
+
+#include <utils/trace_recorder.h>
+
+//CPU time consumed so far by the calling thread, in seconds
+inline double thread_cpu_time() {
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+//CPU time consumed so far by all threads of the process, in seconds
+inline double process_cpu_time() {
+	struct timespec ts;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+//Peak resident set size of the process, in KB
+inline long peak_rss_kb() {
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_maxrss;
+}
+
+class perf_record {
+public:
+	int iteration;
+	std::string type;
+	std::string stage;
+	double wall, cpu;
+	long rss;
+	std::vector < std::pair < std::string, double > > metrics;
+	std::vector < std::pair < std::string, std::vector < double > > > threads;
+};
+
+class perf_report {
+protected:
+	bool enabled;
+	int current_iteration;
+	std::string current_type;
+	std::vector < std::chrono::time_point<std::chrono::steady_clock> > open_wall;
+	std::vector < double > open_cpu;
+	std::vector < int64_t > open_trace;
+	trace_recorder * tracer;
+	std::chrono::time_point<std::chrono::steady_clock> start;
+	std::vector < perf_record > records;
+
+public:
+	perf_report() {
+		enabled = false;
+		current_iteration = 0;
+		current_type = "initialisation";
+		tracer = NULL;
+		start = std::chrono::steady_clock::now();
+	}
+
+	~perf_report() {
+		records.clear();
+	}
+
+	void enable() {
+		enabled = true;
+	}
+
+	bool active() const {
+		return enabled;
+	}
+
+	//Stages are also recorded on the main track of this tracer
+	void attach(trace_recorder * _tracer) {
+		tracer = _tracer;
+	}
+
+	//Records that follow belong to this MCMC iteration (0 and a type name outside of the MCMC)
+	void iteration(int _iteration, std::string _type) {
+		current_iteration = _iteration;
+		current_type = _type;
+	}
+
+	//Stages nest: end() closes the latest begin()
+	void begin() {
+		if (tracer) open_trace.push_back(tracer->now());
+		if (!enabled) return;
+		open_wall.push_back(std::chrono::steady_clock::now());
+		open_cpu.push_back(process_cpu_time());
+	}
+
+	void end(std::string stage) {
+		if (tracer) {
+			tracer->record(0, tracer->intern(stage), open_trace.back(), "iteration", current_iteration);
+			open_trace.pop_back();
+		}
+		if (!enabled) return;
+		perf_record r;
+		r.iteration = current_iteration;
+		r.type = current_type;
+		r.stage = stage;
+		r.wall = std::chrono::duration < double > (std::chrono::steady_clock::now() - open_wall.back()).count();
+		r.cpu = process_cpu_time() - open_cpu.back();
+		r.rss = peak_rss_kb();
+		open_wall.pop_back();
+		open_cpu.pop_back();
+		records.push_back(r);
+	}
+
+	//Attach a value or a per-thread vector to the last closed stage
+	void metric(std::string key, double value) {
+		if (!enabled || records.empty()) return;
+		records.back().metrics.push_back(std::make_pair(key, value));
+	}
+
+	void threads(std::string key, const std::vector < double > & values) {
+		if (!enabled || records.empty()) return;
+		records.back().threads.push_back(std::make_pair(key, values));
+	}
+
+	bool write(std::string fname, std::vector < std::pair < std::string, std::string > > & header) {
+		std::ofstream fd (fname.c_str());
+		if (!fd.is_open()) return false;
+		fd << std::setprecision(6) << "{\n";
+		for (int h = 0 ; h < header.size() ; h ++) fd << "  \"" << header[h].first << "\": \"" << header[h].second << "\",\n";
+		fd << "  \"wall_s\": " << std::chrono::duration < double > (std::chrono::steady_clock::now() - start).count() << ",\n";
+		fd << "  \"cpu_s\": " << process_cpu_time() << ",\n";
+		fd << "  \"peak_rss_kb\": " << peak_rss_kb() << ",\n";
+		fd << "  \"stages\": [";
+		for (int r = 0 ; r < records.size() ; r ++) {
+			fd << (r?",":"") << "\n    {\"iteration\": " << records[r].iteration << ", \"type\": \"" << records[r].type << "\", \"stage\": \"" << records[r].stage << "\"";
+			fd << ", \"wall_s\": " << records[r].wall << ", \"cpu_s\": " << records[r].cpu << ", \"peak_rss_kb\": " << records[r].rss;
+			for (int m = 0 ; m < records[r].metrics.size() ; m ++) fd << ", \"" << records[r].metrics[m].first << "\": " << records[r].metrics[m].second;
+			if (records[r].threads.size()) {
+				fd << ", \"threads\": {";
+				for (int t = 0 ; t < records[r].threads.size() ; t ++) {
+					fd << (t?", ":"") << "\"" << records[r].threads[t].first << "\": [";
+					for (int v = 0 ; v < records[r].threads[t].second.size() ; v ++) fd << (v?", ":"") << records[r].threads[t].second[v];
+					fd << "]";
+				}
+				fd << "}";
+			}
+			fd << "}";
+		}
+		fd << "\n  ]\n}\n";
+		fd.close();
+		return true;
+	}
+};
+
+#endif
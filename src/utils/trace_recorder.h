@@ -0,0 +1,137 @@
+/*******************************************************************************
+ * Copyright (C) 2018 Olivier Delaneau, University of Lausanne
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ ******************************************************************************/
+#ifndef _TRACE_RECORDER_H
+#define _TRACE_RECORDER_H
+
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <set>
+#include <cstdint>
+#include <cstddef>
+
+#define TRACE_CAPACITY	(1 << 16)	//Events kept per track, older events are overwritten
+
+//One complete event ("ph":"X"); names are static strings or interned by trace_recorder::intern
+class trace_event {
+public:
+	const char * name;
+	int64_t start, duration;	//ns since the recorder was created
+	const char * key0, * key1;	//Optional named integer arguments
+	int arg0, arg1;
+};
+
+//Ring buffer of one thread; tracks are heap allocated apart from each other
+class trace_track {
+public:
+	std::vector < trace_event > events;
+	unsigned long n_events;
+	std::string name;
+
+	trace_track(std::string _name) : events(TRACE_CAPACITY), n_events(0), name(_name) {
+	}
+};
+
+class trace_recorder {
+protected:
+	std::chrono::time_point<std::chrono::steady_clock> origin;
+	std::vector < trace_track * > tracks;
+	std::set < std::string > names;
+
+public:
+	trace_recorder() {
+		origin = std::chrono::steady_clock::now();
+	}
+
+	~trace_recorder() {
+		for (int t = 0 ; t < tracks.size() ; t ++) delete tracks[t];
+		tracks.clear();
+	}
+
+	//Track 0 is the main thread, tracks 1 to n_workers are the HMM workers
+	void enable(int n_workers) {
+		tracks.push_back(new trace_track("main"));
+		for (int w = 0 ; w < n_workers ; w ++) tracks.push_back(new trace_track("worker " + std::to_string(w)));
+	}
+
+	bool active() const {
+		return !tracks.empty();
+	}
+
+	int64_t now() const {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - origin).count();
+	}
+
+	const char * intern(const std::string & name) {
+		return names.insert(name).first->c_str();
+	}
+
+	//Only the thread owning a track writes into it
+	void record(int track, const char * name, int64_t start, const char * key0 = NULL, int arg0 = 0, const char * key1 = NULL, int arg1 = 0) {
+		trace_track * T = tracks[track];
+		trace_event & e = T->events[T->n_events % TRACE_CAPACITY];
+		e.name = name;
+		e.start = start;
+		e.duration = now() - start;
+		e.key0 = key0;
+		e.key1 = key1;
+		e.arg0 = arg0;
+		e.arg1 = arg1;
+		T->n_events ++;
+	}
+
+	unsigned long dropped() const {
+		unsigned long n = 0;
+		for (int t = 0 ; t < tracks.size() ; t ++) if (tracks[t]->n_events > TRACE_CAPACITY) n += tracks[t]->n_events - TRACE_CAPACITY;
+		return n;
+	}
+
+	//Chrome Trace Event format, viewable in chrome://tracing or Perfetto
+	bool write(std::string fname) {
+		std::ofstream fd (fname.c_str());
+		if (!fd.is_open()) return false;
+		fd << std::fixed << std::setprecision(3) << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+		bool first = true;
+		for (int t = 0 ; t < tracks.size() ; t ++) {
+			fd << (first?"":",") << "\n{\"ph\": \"M\", \"name\": \"thread_name\", \"pid\": 1, \"tid\": " << t << ", \"args\": {\"name\": \"" << tracks[t]->name << "\"}}";
+			first = false;
+			unsigned long n = std::min(tracks[t]->n_events, (unsigned long)TRACE_CAPACITY);
+			for (unsigned long i = tracks[t]->n_events - n ; i < tracks[t]->n_events ; i ++) {
+				trace_event & e = tracks[t]->events[i % TRACE_CAPACITY];
+				fd << ",\n{\"ph\": \"X\", \"pid\": 1, \"tid\": " << t << ", \"name\": \"" << e.name << "\", \"ts\": " << e.start * 1e-3 << ", \"dur\": " << e.duration * 1e-3;
+				if (e.key0) {
+					fd << ", \"args\": {\"" << e.key0 << "\": " << e.arg0;
+					if (e.key1) fd << ", \"" << e.key1 << "\": " << e.arg1;
+					fd << "}";
+				}
+				fd << "}";
+			}
+		}
+		fd << "\n]}\n";
+		fd.close();
+		return true;
+	}
+};
+
+#endif
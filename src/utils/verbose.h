@@ -49,12 +49,14 @@ protected:
 	ofstream log;
 	bool verbose_on_screen;
 	bool verbose_on_log;
+	bool muted;
 	int prev_percent;
 
 public:
 	verbose() {
 		verbose_on_screen = true;
 		verbose_on_log = false;
+		muted = false;
 		prev_percent = -1;
 	}
 
@@ -76,22 +78,31 @@ public:
 		verbose_on_screen = false;
 	}
 
+	//Mutes everything but warnings and errors (e.g. while concurrent tasks run)
+	void set_muted(bool _muted) {
+		muted = _muted;
+	}
+
 	void print(string s) {
+		if (muted) return;
 		if (verbose_on_screen) cout << s << endl;
 		if (verbose_on_log) log << s << endl;
 	}
 
 	void ctitle(string s) {
+		if (muted) return;
 		if (verbose_on_screen) cout << endl << "\x1B[32m" << s <<  "\033[0m" << endl;
 		if (verbose_on_log) log << endl << s << endl;
 	}
 
 	void title(string s) {
+		if (muted) return;
 		if (verbose_on_screen) cout << endl << s << endl;
 		if (verbose_on_log) log << endl << s << endl;
 	}
 
 	void bullet(string s) {
+		if (muted) return;
 		if (verbose_on_screen) cout << "  * " << s << endl;
 		if (verbose_on_log) log << "  * " << s << endl;
 	}
@@ -120,14 +131,14 @@ public:
 	}
 
 	void wait(string s) {
-		if (verbose_on_screen) {
+		if (verbose_on_screen && !muted) {
 			cout << s << " ...\r";
 			cout.flush();
 		}
 	}
 
 	void progress(string prefix, float percent) {
-		if (verbose_on_screen) {
+		if (verbose_on_screen && !muted) {
 			int curr_percent = int(percent * 100.0);
 			if (prev_percent > curr_percent) prev_percent = -1;
 			if (curr_percent > prev_percent) {